@@ -0,0 +1,108 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+class aabb
+{
+    public:
+        interval x, y, z; //Empty box by default
+
+        aabb() {}
+        aabb(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {}
+
+        aabb(const point3& a, const point3& b) //Box spanning two corner points in any order
+        {
+            x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+            y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+            z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+        }
+
+        aabb(const aabb& box0, const aabb& box1) : x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+        const interval& axis(int n) const
+        {
+            if(n == 1) return y;
+            if(n == 2) return z;
+            return x;
+        }
+
+        bool empty() const
+        {
+            return x.min > x.max || y.min > y.max || z.min > z.max;
+        }
+
+        point3 centroid() const
+        {
+            return point3(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+        }
+
+        double surface_area() const
+        {
+            if(empty()) return 0;
+            auto dx = x.size(), dy = y.size(), dz = z.size();
+            return 2.0 * (dx*dy + dy*dz + dz*dx);
+        }
+
+        int longest_axis() const
+        {
+            if(x.size() > y.size())
+                return x.size() > z.size() ? 0 : 2;
+            return y.size() > z.size() ? 1 : 2;
+        }
+
+        bool hit(const ray& r, interval ray_t) const
+        {
+            vec3 dir = r.direction();
+            vec3 inv_dir(1/dir[0], 1/dir[1], 1/dir[2]);
+            return hit(r.origin(), inv_dir, ray_t);
+        }
+
+        //Slab test with the reciprocal direction precomputed by the caller, so traversals pay the divides once per ray
+        bool hit(const point3& orig, const vec3& inv_dir, interval ray_t) const
+        {
+            for(int a = 0; a < 3; a++)
+            {
+                auto t0 = (axis(a).min - orig[a]) * inv_dir[a];
+                auto t1 = (axis(a).max - orig[a]) * inv_dir[a];
+                if(inv_dir[a] < 0)
+                    std::swap(t0, t1);
+
+                if(t0 > ray_t.min) ray_t.min = t0;
+                if(t1 < ray_t.max) ray_t.max = t1;
+                if(ray_t.max <= ray_t.min)
+                    return false;
+            }
+            return true;
+        }
+};
+
+//Spreads the low 10 bits of v so there are two zero bits between each of them
+inline uint32_t expand_bits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+//30 bit Morton code of p quantized to a 1024^3 grid over bounds, x highest; points outside are clamped
+inline uint32_t morton_code(const point3& p, const aabb& bounds)
+{
+    uint32_t code = 0;
+    for(int a = 0; a < 3; a++)
+    {
+        auto extent = bounds.axis(a);
+        auto f = extent.size() > 0 ? (p[a] - extent.min) / extent.size() : 0.0;
+        auto q = static_cast<uint32_t>(std::min(std::max(f * 1024.0, 0.0), 1023.0));
+        code |= expand_bits(q) << (2 - a);
+    }
+    return code;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,705 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class bvh_build_method
+{
+    sah, //Binned surface area heuristic: slower build, fastest traversal
+    lbvh //Morton ordered linear BVH: fastest build, looser tree
+};
+
+enum class bvh_update
+{
+    refit,           //Boxes refitted, topology kept
+    partial_rebuild, //Some subtrees rebuilt after refitting
+    full_rebuild     //Whole tree rebuilt from scratch
+};
+
+struct bvh_build_options
+{
+    bvh_build_method method = bvh_build_method::sah;
+    int threads = 0;     //Build threads, 0 uses every hardware thread
+    bool report = false; //Print build time and tree quality to std::clog
+    double rebuild_drift = 1.3; //update() rebuilds subtrees whose SAH cost grew past this factor since they were built
+};
+
+//Root of a bounding volume hierarchy over a set of hittables.
+//The tree is stored flat: children of a node are allocated as a pair, so only the left index is kept,
+//and a child always comes after its parent in the array.
+class bvh_node : public hittable
+{
+    public:
+        //Deepest level of the tree. Ranges reaching it become leaves whatever their size,
+        //so the fixed traversal stacks sized from it can never overflow
+        static const int max_tree_depth = 60;
+
+        struct node
+        {
+            aabb bbox;
+            int start = 0; //First primitive for leaves, left child for interior nodes (right child is start+1)
+            int count = 0; //Number of primitives in a leaf, zero for interior nodes
+            int axis = 0;  //Split axis, decides which child a ray visits first
+        };
+
+        bvh_node(const hittable_list& list, const bvh_build_options& opts = bvh_build_options())
+        : bvh_node(list.objects, opts) {}
+
+        bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, const bvh_build_options& opts = bvh_build_options())
+        : objects(src_objects), options(opts)
+        {
+            build();
+        }
+
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
+        {
+            if(nodes.empty()) return false;
+
+            point3 orig = r.origin();
+            vec3 dir = r.direction();
+            vec3 inv_dir(1/dir[0], 1/dir[1], 1/dir[2]);
+
+            int stack[max_tree_depth + 4];
+            int top = 0;
+            stack[top++] = 0;
+            bool hit_anything = false;
+
+            while(top > 0)
+            {
+                const node& n = nodes[stack[--top]];
+                if(!n.bbox.hit(orig, inv_dir, ray_t))
+                    continue;
+
+                if(n.count > 0)
+                {
+                    for(int i = n.start; i < n.start + n.count; i++)
+                    {
+                        if(objects[i]->intersect(r, ray_t, hit))
+                        {
+                            hit_anything = true;
+                            ray_t.max = hit.t; //Only closer hits matter from here on
+                        }
+                    }
+                }
+                else if(dir[n.axis] < 0) //Push the far child first so the near one is popped next
+                {
+                    stack[top++] = n.start;
+                    stack[top++] = n.start + 1;
+                }
+                else
+                {
+                    stack[top++] = n.start + 1;
+                    stack[top++] = n.start;
+                }
+            }
+            return hit_anything;
+        }
+
+        void bind_materials(material_table& table) override
+        {
+            for(const auto& object : objects)
+                object->bind_materials(table);
+        }
+
+        aabb bounding_box() const override { return nodes.empty() ? aabb() : nodes[0].bbox; }
+
+        const std::vector<node>& tree() const { return nodes; }
+        const std::vector<shared_ptr<hittable>>& primitives() const { return objects; }
+
+        double build_time() const { return build_ms; } //Milliseconds spent in the last build or update
+
+        //Expected cost of a random ray relative to testing one primitive, lower is better
+        double sah_cost() const
+        {
+            if(nodes.empty()) return 0;
+            double cost = 0;
+            int stack[max_tree_depth + 4];
+            int top = 0;
+            stack[top++] = 0;
+            while(top > 0)
+            {
+                const node& n = nodes[stack[--top]];
+                cost += n.bbox.surface_area() * (n.count > 0 ? n.count : traversal_cost);
+                if(n.count == 0)
+                {
+                    stack[top++] = n.start;
+                    stack[top++] = n.start + 1;
+                }
+            }
+            auto root_area = nodes[0].bbox.surface_area();
+            return root_area > 0 ? cost / root_area : cost;
+        }
+
+        //Call after primitives moved or changed size. Refits every box bottom up in O(n), then rebuilds the
+        //subtrees whose SAH cost drifted past options.rebuild_drift; a drifted root means a full rebuild.
+        bvh_update update()
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            if(nodes.empty()) return bvh_update::refit;
+
+            refit();
+            std::vector<std::pair<int, int>> drifted; //Subtree roots and their depths
+            collect_drifted(0, 0, drifted);
+
+            //Replaced subtrees leave unreachable nodes behind, compact them with a full build once they pile up
+            bvh_update result = bvh_update::refit;
+            if(!drifted.empty() && (drifted[0].first == 0 || garbage_nodes > static_cast<int>(nodes.size()) / 2))
+            {
+                build();
+                result = bvh_update::full_rebuild;
+            }
+            else if(!drifted.empty())
+            {
+                int first_new = next_node;
+                for(const auto& d : drifted)
+                    rebuild_subtree(d.first, d.second);
+                update_costs();
+                for(const auto& d : drifted)
+                    built_cost[d.first] = normalized_cost(d.first);
+                for(int i = first_new; i < next_node; i++)
+                    built_cost[i] = normalized_cost(i);
+                result = bvh_update::partial_rebuild;
+            }
+
+            build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if(options.report)
+            {
+                const char* kind = result == bvh_update::refit ? "refit" :
+                    result == bvh_update::partial_rebuild ? "partial rebuild" : "full rebuild";
+                std::clog << "BVH update (" << kind;
+                if(result == bvh_update::partial_rebuild)
+                    std::clog << " of " << drifted.size() << " subtrees";
+                std::clog << "): " << build_ms << " ms, SAH cost " << sah_cost() << "\n";
+            }
+            return result;
+        }
+
+    private:
+        struct prim_ref
+        {
+            aabb bbox;
+            point3 centroid;
+            int index;
+        };
+
+        struct bin
+        {
+            aabb bbox;
+            aabb centroids;
+            int count = 0;
+        };
+
+        struct range_bounds
+        {
+            aabb bbox;      //Union of the primitive boxes
+            aabb centroids; //Bounds of the primitive centroids, used for binning
+        };
+
+        static const int bin_count = 16;
+        static const int max_leaf_size = 4;
+        static const int min_parallel_size = 4096; //Ranges below this are not worth another thread
+        static constexpr double traversal_cost = 0.125; //Cost of a node visit relative to one primitive test
+
+        struct bin_set
+        {
+            bin bins[3][bin_count];
+        };
+
+        std::vector<shared_ptr<hittable>> objects; //Reordered so every leaf covers a contiguous range
+        std::vector<node> nodes;
+        bvh_build_options options;
+        std::atomic<int> next_node{0};
+        int prim_offset = 0;   //Added to leaf starts while building a subtree over part of the primitives
+        int garbage_nodes = 0; //Unreachable nodes left by partial rebuilds
+        std::vector<double> subtree_cost; //Unnormalized SAH cost of each subtree, filled by refit()
+        std::vector<double> built_cost;   //Normalized subtree cost when the subtree was last built
+        double build_ms = 0;
+
+        int build_threads() const
+        {
+            int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+            return std::max(threads, 1);
+        }
+
+        void build()
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            int threads = build_threads();
+
+            nodes.clear();
+            prim_offset = 0;
+            garbage_nodes = 0;
+            int n = static_cast<int>(objects.size());
+            if(n == 0) return;
+
+            std::vector<prim_ref> refs(n);
+            parallel_for(0, n, threads, [&](int begin, int end, int) {
+                for(int i = begin; i < end; i++)
+                {
+                    refs[i].bbox = objects[i]->bounding_box();
+                    refs[i].centroid = refs[i].bbox.centroid();
+                    refs[i].index = i;
+                }
+            });
+
+            //A binary tree with at least one primitive per leaf has fewer than 2n nodes,
+            //so workers can claim child pairs with an atomic counter and never reallocate
+            nodes.resize(2 * n);
+            next_node = 1;
+            if(options.method == bvh_build_method::lbvh)
+                build_lbvh(refs, threads);
+            else
+                build_sah(refs, 0, 0, n, 0, threads, compute_bounds(refs, 0, n, threads));
+            nodes.resize(next_node);
+
+            std::vector<shared_ptr<hittable>> ordered(n);
+            parallel_for(0, n, threads, [&](int begin, int end, int) {
+                for(int i = begin; i < end; i++)
+                    ordered[i] = objects[refs[i].index];
+            });
+            objects.swap(ordered);
+
+            update_costs();
+            built_cost.resize(nodes.size());
+            for(int i = 0; i < static_cast<int>(nodes.size()); i++)
+                built_cost[i] = normalized_cost(i);
+
+            build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if(options.report)
+            {
+                std::clog << "BVH build (" << (options.method == bvh_build_method::lbvh ? "lbvh" : "sah") << ", "
+                          << threads << " threads): " << n << " primitives, " << nodes.size() << " nodes, "
+                          << build_ms << " ms, SAH cost " << sah_cost() << "\n";
+            }
+        }
+
+        //Children come after their parents, so a reverse sweep sees both children before the parent
+        void refit()
+        {
+            subtree_cost.resize(nodes.size());
+            for(int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--)
+            {
+                node& n = nodes[i];
+                if(n.count > 0)
+                {
+                    aabb bbox;
+                    for(int p = n.start; p < n.start + n.count; p++)
+                        bbox = aabb(bbox, objects[p]->bounding_box());
+                    n.bbox = bbox;
+                    subtree_cost[i] = bbox.surface_area() * n.count;
+                }
+                else
+                {
+                    n.bbox = aabb(nodes[n.start].bbox, nodes[n.start + 1].bbox);
+                    subtree_cost[i] = n.bbox.surface_area() * traversal_cost + subtree_cost[n.start] + subtree_cost[n.start + 1];
+                }
+            }
+        }
+
+        void update_costs()
+        {
+            subtree_cost.resize(nodes.size());
+            built_cost.resize(nodes.size());
+            for(int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--)
+            {
+                const node& n = nodes[i];
+                if(n.count > 0)
+                    subtree_cost[i] = n.bbox.surface_area() * n.count;
+                else
+                    subtree_cost[i] = n.bbox.surface_area() * traversal_cost + subtree_cost[n.start] + subtree_cost[n.start + 1];
+            }
+        }
+
+        //Subtree cost per unit of its root's area, so uniform growth of every box does not count as drift
+        double normalized_cost(int i) const
+        {
+            auto area = nodes[i].bbox.surface_area();
+            return area > 0 ? subtree_cost[i] / area : 0;
+        }
+
+        //Collects the topmost subtrees whose cost drifted too far, their descendants are rebuilt with them
+        void collect_drifted(int i, int depth, std::vector<std::pair<int, int>>& drifted) const
+        {
+            const node& n = nodes[i];
+            if(n.count > 0) return;
+            if(built_cost[i] > 0 && normalized_cost(i) > options.rebuild_drift * built_cost[i])
+            {
+                drifted.emplace_back(i, depth);
+                return;
+            }
+            collect_drifted(n.start, depth + 1, drifted);
+            collect_drifted(n.start + 1, depth + 1, drifted);
+        }
+
+        //Rebuilds the subtree under root in place; its new descendants are appended to the node array
+        void rebuild_subtree(int root, int depth)
+        {
+            int first = static_cast<int>(objects.size());
+            int count = 0;
+            int stack[max_tree_depth + 4];
+            int top = 0;
+            stack[top++] = root;
+            while(top > 0)
+            {
+                const node& n = nodes[stack[--top]];
+                if(n.count > 0)
+                {
+                    first = std::min(first, n.start);
+                    count += n.count;
+                }
+                else
+                {
+                    garbage_nodes += 2;
+                    stack[top++] = n.start;
+                    stack[top++] = n.start + 1;
+                }
+            }
+
+            int threads = build_threads();
+            std::vector<prim_ref> refs(count);
+            for(int i = 0; i < count; i++)
+            {
+                refs[i].bbox = objects[first + i]->bounding_box();
+                refs[i].centroid = refs[i].bbox.centroid();
+                refs[i].index = first + i;
+            }
+
+            nodes.resize(next_node + 2 * count);
+            prim_offset = first;
+            build_sah(refs, root, 0, count, depth, threads, compute_bounds(refs, 0, count, threads));
+            prim_offset = 0;
+            nodes.resize(next_node);
+
+            std::vector<shared_ptr<hittable>> ordered(count);
+            for(int i = 0; i < count; i++)
+                ordered[i] = objects[refs[i].index];
+            std::move(ordered.begin(), ordered.end(), objects.begin() + first);
+        }
+
+        static int chunk_count(int n, int threads)
+        {
+            return std::max(1, std::min(threads, n / min_parallel_size));
+        }
+
+        //Runs body(task) for every task index, the first one on the calling thread
+        template<typename F>
+        static void run_tasks(int tasks, const F& body)
+        {
+            std::vector<std::thread> workers;
+            for(int c = 1; c < tasks; c++)
+                workers.emplace_back([&body, c] { body(c); });
+            body(0);
+            for(auto& t : workers)
+                t.join();
+        }
+
+        //Runs body(begin, end, chunk) over [begin, end) split into chunk_count() contiguous chunks
+        template<typename F>
+        static void parallel_for(int begin, int end, int threads, const F& body)
+        {
+            long long n = end - begin;
+            int chunks = chunk_count(end - begin, threads);
+            run_tasks(chunks, [&](int c) {
+                body(begin + static_cast<int>(n * c / chunks), begin + static_cast<int>(n * (c + 1) / chunks), c);
+            });
+        }
+
+        //Builds the two subtrees, handing the left one to a new thread while this subtree still owns more than one
+        template<typename L, typename R>
+        static void fork(int count, int threads, const L& left, const R& right)
+        {
+            if(threads > 1 && count >= min_parallel_size)
+            {
+                std::thread t([&left, threads] { left(threads / 2); });
+                right(threads - threads / 2);
+                t.join();
+            }
+            else
+            {
+                left(1);
+                right(1);
+            }
+        }
+
+        int make_leaf_or_split(int node_index, int start, int end, int mid, int axis)
+        {
+            if(mid == start)
+            {
+                nodes[node_index].start = start + prim_offset;
+                nodes[node_index].count = end - start;
+                return -1;
+            }
+            int left = next_node.fetch_add(2);
+            nodes[node_index].start = left;
+            nodes[node_index].count = 0;
+            nodes[node_index].axis = axis;
+            return left;
+        }
+
+        static range_bounds compute_bounds(const std::vector<prim_ref>& refs, int start, int end, int threads)
+        {
+            range_bounds single;
+            std::vector<range_bounds> partial;
+            int chunks = chunk_count(end - start, threads);
+            auto* sets = &single;
+            if(chunks > 1)
+            {
+                partial.resize(chunks);
+                sets = partial.data();
+            }
+            parallel_for(start, end, threads, [&](int begin, int finish, int chunk) {
+                range_bounds b;
+                for(int i = begin; i < finish; i++)
+                {
+                    b.bbox = aabb(b.bbox, refs[i].bbox);
+                    b.centroids = aabb(b.centroids, aabb(refs[i].centroid, refs[i].centroid));
+                }
+                sets[chunk] = b;
+            });
+            for(int c = 1; c < chunks; c++)
+            {
+                sets[0].bbox = aabb(sets[0].bbox, sets[c].bbox);
+                sets[0].centroids = aabb(sets[0].centroids, sets[c].centroids);
+            }
+            return sets[0];
+        }
+
+        //Bounds of the range come from the parent's bins, so each level only bins and partitions
+        void build_sah(std::vector<prim_ref>& refs, int node_index, int start, int end, int depth, int threads,
+            const range_bounds& bounds)
+        {
+            nodes[node_index].bbox = bounds.bbox;
+
+            int count = end - start;
+            int axis = bounds.centroids.longest_axis();
+            int mid = start;
+            range_bounds left_bounds, right_bounds;
+
+            if(count > 1 && depth < max_tree_depth)
+                mid = sah_split(refs, start, end, bounds, axis, threads, left_bounds, right_bounds);
+
+            if(mid == start && count > max_leaf_size && depth < max_tree_depth)
+            {
+                //SAH found no usable plane: fall back to an object median split
+                mid = start + count/2;
+                std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+                    [axis](const prim_ref& a, const prim_ref& b) { return a.centroid[axis] < b.centroid[axis]; });
+                left_bounds = compute_bounds(refs, start, mid, threads);
+                right_bounds = compute_bounds(refs, mid, end, threads);
+            }
+
+            int left = make_leaf_or_split(node_index, start, end, mid, axis);
+            if(left < 0) return;
+
+            fork(count, threads,
+                [&](int t) { build_sah(refs, left, start, mid, depth + 1, t, left_bounds); },
+                [&](int t) { build_sah(refs, left + 1, mid, end, depth + 1, t, right_bounds); });
+        }
+
+        //Partitions refs around the cheapest binned SAH plane and returns the split index,
+        //or start when a leaf is cheaper than any split
+        int sah_split(std::vector<prim_ref>& refs, int start, int end, const range_bounds& bounds,
+            int& axis, int threads, range_bounds& left_bounds, range_bounds& right_bounds) const
+        {
+            const aabb& centroid_bounds = bounds.centroids;
+            //Each chunk fills its own bins for all three axes, merged afterwards
+            bin_set single;
+            std::vector<bin_set> partial;
+            int chunks = chunk_count(end - start, threads);
+            auto* sets = &single;
+            if(chunks > 1)
+            {
+                partial.resize(chunks);
+                sets = partial.data();
+            }
+            parallel_for(start, end, threads, [&](int begin, int finish, int chunk) {
+                auto& bins = sets[chunk].bins;
+                for(int a = 0; a < 3; a++)
+                {
+                    auto extent = centroid_bounds.axis(a);
+                    if(extent.size() <= 0) continue;
+                    auto scale = bin_count / extent.size();
+                    for(int i = begin; i < finish; i++)
+                    {
+                        int b = std::min(bin_count - 1, static_cast<int>((refs[i].centroid[a] - extent.min) * scale));
+                        bins[a][b].count++;
+                        bins[a][b].bbox = aabb(bins[a][b].bbox, refs[i].bbox);
+                        bins[a][b].centroids = aabb(bins[a][b].centroids, aabb(refs[i].centroid, refs[i].centroid));
+                    }
+                }
+            });
+            for(int c = 1; c < chunks; c++)
+            {
+                for(int a = 0; a < 3; a++)
+                {
+                    for(int b = 0; b < bin_count; b++)
+                    {
+                        sets[0].bins[a][b].count += sets[c].bins[a][b].count;
+                        sets[0].bins[a][b].bbox = aabb(sets[0].bins[a][b].bbox, sets[c].bins[a][b].bbox);
+                        sets[0].bins[a][b].centroids = aabb(sets[0].bins[a][b].centroids, sets[c].bins[a][b].centroids);
+                    }
+                }
+            }
+
+            int count = end - start;
+            double best_cost = infinity;
+            int best_axis = -1;
+            int best_bin = -1;
+
+            for(int a = 0; a < 3; a++)
+            {
+                if(centroid_bounds.axis(a).size() <= 0) continue;
+                const auto& bins = sets[0].bins[a];
+
+                //Sweep from the right to gather the right hand side of every plane, then evaluate from the left
+                double right_area[bin_count];
+                int right_count[bin_count];
+                aabb acc;
+                int acc_count = 0;
+                for(int b = bin_count - 1; b > 0; b--)
+                {
+                    acc = aabb(acc, bins[b].bbox);
+                    acc_count += bins[b].count;
+                    right_area[b] = acc.surface_area();
+                    right_count[b] = acc_count;
+                }
+
+                acc = aabb();
+                acc_count = 0;
+                for(int b = 0; b < bin_count - 1; b++)
+                {
+                    acc = aabb(acc, bins[b].bbox);
+                    acc_count += bins[b].count;
+                    if(acc_count == 0 || right_count[b + 1] == 0) continue;
+
+                    auto cost = acc.surface_area() * acc_count + right_area[b + 1] * right_count[b + 1];
+                    if(cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = a;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            if(best_axis < 0) return start;
+
+            auto area = bounds.bbox.surface_area();
+            auto split_cost = traversal_cost + (area > 0 ? best_cost / area : 0);
+            if(count <= max_leaf_size && split_cost >= count)
+                return start;
+
+            axis = best_axis;
+            for(int b = 0; b < bin_count; b++)
+            {
+                auto& side = b <= best_bin ? left_bounds : right_bounds;
+                side.bbox = aabb(side.bbox, sets[0].bins[best_axis][b].bbox);
+                side.centroids = aabb(side.centroids, sets[0].bins[best_axis][b].centroids);
+            }
+
+            auto extent = centroid_bounds.axis(best_axis);
+            auto scale = bin_count / extent.size();
+            auto it = std::partition(refs.begin() + start, refs.begin() + end, [&](const prim_ref& ref) {
+                int b = std::min(bin_count - 1, static_cast<int>((ref.centroid[best_axis] - extent.min) * scale));
+                return b <= best_bin;
+            });
+            return static_cast<int>(it - refs.begin());
+        }
+
+        void build_lbvh(std::vector<prim_ref>& refs, int threads)
+        {
+            int n = static_cast<int>(refs.size());
+            aabb centroid_bounds;
+            for(const auto& ref : refs)
+                centroid_bounds = aabb(centroid_bounds, aabb(ref.centroid, ref.centroid));
+
+            std::vector<std::pair<uint32_t, int>> keys(n);
+            parallel_for(0, n, threads, [&](int begin, int end, int) {
+                for(int i = begin; i < end; i++)
+                    keys[i] = std::make_pair(morton_code(refs[i].centroid, centroid_bounds), i);
+            });
+
+            //Sort chunks in parallel, then merge neighbouring runs pairwise
+            int chunks = chunk_count(n, threads);
+            std::vector<int> bounds(chunks + 1);
+            for(int c = 0; c <= chunks; c++)
+                bounds[c] = static_cast<int>(static_cast<long long>(n) * c / chunks);
+            run_tasks(chunks, [&](int c) {
+                std::sort(keys.begin() + bounds[c], keys.begin() + bounds[c + 1]);
+            });
+            for(int width = 1; width < chunks; width *= 2)
+            {
+                int merges = (chunks - width + 2 * width - 1) / (2 * width);
+                run_tasks(merges, [&](int m) {
+                    int c = m * 2 * width;
+                    int lo = bounds[c], mid = bounds[c + width], hi = bounds[std::min(c + 2 * width, chunks)];
+                    std::inplace_merge(keys.begin() + lo, keys.begin() + mid, keys.begin() + hi);
+                });
+            }
+
+            std::vector<prim_ref> sorted(n);
+            std::vector<uint32_t> codes(n);
+            parallel_for(0, n, threads, [&](int begin, int end, int) {
+                for(int i = begin; i < end; i++)
+                {
+                    sorted[i] = refs[keys[i].second];
+                    codes[i] = keys[i].first;
+                }
+            });
+            refs.swap(sorted);
+
+            build_lbvh_range(refs, codes, 0, 0, n, 0, threads);
+        }
+
+        //Splits at the highest bit where the range's Morton codes differ; boxes are filled in bottom up
+        void build_lbvh_range(const std::vector<prim_ref>& refs, const std::vector<uint32_t>& codes,
+            int node_index, int start, int end, int depth, int threads)
+        {
+            int count = end - start;
+            int mid = start;
+            int axis = 0;
+            if(count > max_leaf_size && depth < max_tree_depth)
+            {
+                uint32_t diff = codes[start] ^ codes[end - 1];
+                if(diff == 0)
+                    mid = start + count/2; //Identical codes, split the range in the middle
+                else
+                {
+                    int bit = 31;
+                    while(!(diff & (1u << bit))) bit--;
+                    axis = 2 - bit % 3;
+                    uint32_t mask = 1u << bit;
+                    mid = static_cast<int>(std::partition_point(codes.begin() + start, codes.begin() + end,
+                        [mask](uint32_t code) { return !(code & mask); }) - codes.begin());
+                }
+            }
+
+            int left = make_leaf_or_split(node_index, start, end, mid, axis);
+            if(left < 0)
+            {
+                aabb bbox;
+                for(int i = start; i < end; i++)
+                    bbox = aabb(bbox, refs[i].bbox);
+                nodes[node_index].bbox = bbox;
+                return;
+            }
+
+            fork(count, threads,
+                [&](int t) { build_lbvh_range(refs, codes, left, start, mid, depth + 1, t); },
+                [&](int t) { build_lbvh_range(refs, codes, left + 1, mid, end, depth + 1, t); });
+            nodes[node_index].bbox = aabb(nodes[left].bbox, nodes[left + 1].bbox);
+        }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,447 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "bvh.h"
+#include "simd.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+
+//W-wide bounding volume hierarchy (W = 4 or 8) collapsed from a binary bvh_node.
+//Child boxes are kept as single precision structure-of-arrays so one SSE/AVX slab test covers every child of a node.
+template<int W>
+class bvh_wide : public hittable
+{
+    static_assert(W == 4 || W == 8, "bvh_wide supports 4 or 8 children per node");
+
+    public:
+        struct node
+        {
+            alignas(32) float lo[3][W]; //Child box minimums per axis, empty slots hold +infinity
+            alignas(32) float hi[3][W]; //Child box maximums per axis, empty slots hold -infinity
+            int child[W]; //Wide node index for inner children, first primitive for leaves
+            int count[W]; //Primitive count for leaves, zero for inner children and empty slots
+        };
+
+        bvh_wide(const hittable_list& list, const bvh_build_options& opts = bvh_build_options())
+        : bvh_wide(bvh_node(list, opts)) {}
+
+        bvh_wide(const bvh_node& tree) : objects(tree.primitives())
+        {
+            const auto& binary = tree.tree();
+            if(binary.empty()) return;
+            bbox = binary[0].bbox;
+            nodes.reserve(binary.size() / 2 + 1);
+            collapse(binary, 0);
+        }
+
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
+        {
+            if(nodes.empty()) return false;
+            return traverse(0, 0, r, ray_t, hit);
+        }
+
+        //Traces a packet that ray_packet::finish() found coherent down the tree together. Inner nodes test
+        //the bounds of the whole packet against all children at once; leaf boxes are tested lane by lane,
+        //and where fewer than a quarter of the lanes enter a leaf they are finished one ray at a time.
+        void intersect_packet(ray_packet& p, uint32_t lanes, closest_hit* hits) const override
+        {
+            if(nodes.empty()) return;
+
+            struct entry
+            {
+                int index;
+                int count; //Non-zero for leaves
+                uint32_t lanes; //Rays that entered the box
+                float tnear; //Nearest entry of those rays
+            };
+            entry stack[(W - 1) * (max_depth + 1) + 1];
+            int top = 0;
+            stack[top++] = entry{0, 0, lanes, static_cast<float>(p.tmin)};
+            const int split_below = std::max(2, p.size / 4);
+
+            while(top > 0)
+            {
+                entry e = stack[--top];
+                float farthest = -static_cast<float>(infinity); //Closest hit of the lane that has found the least
+                for(uint32_t m = e.lanes; m; m &= m - 1)
+                    farthest = std::max(farthest, p.ftmax[lowest_bit(m)]);
+                if(e.tnear > farthest) continue; //Every lane found a closer hit since this entry was pushed
+
+                if(popcount(e.lanes) < split_below)
+                {
+                    for(int k = 0; k < p.size; k++)
+                    {
+                        if((e.lanes & (1u << k)) && traverse(e.index, e.count, p.lane_ray(k), interval(p.tmin, p.tmax[k]), hits[k]))
+                            p.shorten(k, hits[k].t);
+                    }
+                    continue;
+                }
+
+                if(e.count > 0)
+                {
+                    for(int i = e.index; i < e.index + e.count; i++)
+                        objects[i]->intersect_packet(p, e.lanes, hits);
+                    continue;
+                }
+
+                const node& n = nodes[e.index];
+                alignas(32) float nearest[W];
+                int mask = intersect_children(n, p, farthest, nearest);
+                uint32_t entered[W];
+                int order[W];
+                int k = 0;
+                for(int i = 0; i < W; i++)
+                {
+                    if(!(mask & (1 << i))) continue;
+                    entered[i] = e.lanes;
+                    if(n.count[i] > 0)
+                    {
+                        float lo[3] = {n.lo[0][i], n.lo[1][i], n.lo[2][i]};
+                        float hi[3] = {n.hi[0][i], n.hi[1][i], n.hi[2][i]};
+                        entered[i] = intersect_box(p, e.lanes, lo, hi, nearest[i]);
+                        if(!entered[i]) continue;
+                    }
+
+                    //Push farthest first, as for single rays, by the nearest entry of any lane
+                    int j = k++;
+                    for(; j > 0 && nearest[order[j - 1]] < nearest[i]; j--)
+                        order[j] = order[j - 1];
+                    order[j] = i;
+                }
+                for(int j = 0; j < k; j++)
+                {
+                    int i = order[j];
+                    stack[top++] = entry{n.child[i], n.count[i], entered[i], nearest[i]};
+                }
+            }
+        }
+
+        void bind_materials(material_table& table) override
+        {
+            for(const auto& object : objects)
+                object->bind_materials(table);
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        const std::vector<node>& tree() const { return nodes; }
+
+    private:
+        static const int max_depth = bvh_node::max_tree_depth; //Collapsing never makes the tree deeper
+
+        static int popcount(uint32_t x)
+        {
+            int n = 0;
+            for(; x; x &= x - 1) n++;
+            return n;
+        }
+
+        static int lowest_bit(uint32_t x)
+        {
+            int n = 0;
+            for(; !(x & 1); x >>= 1) n++;
+            return n;
+        }
+
+        //Single ray traversal of the subtree at (index, count), which is a leaf when count is non-zero
+        bool traverse(int index, int count, const ray& r, interval ray_t, closest_hit& hit) const
+        {
+            ray_data rd(r);
+            struct entry
+            {
+                int index;
+                int count; //Non-zero for leaves
+                float tnear;
+            };
+            entry stack[(W - 1) * (max_depth + 1) + 1];
+            int top = 0;
+            stack[top++] = entry{index, count, static_cast<float>(ray_t.min)};
+            bool hit_anything = false;
+
+            while(top > 0)
+            {
+                entry e = stack[--top];
+                if(e.tnear > ray_t.max) continue; //A closer hit was found since this entry was pushed
+
+                if(e.count > 0)
+                {
+                    for(int i = e.index; i < e.index + e.count; i++)
+                    {
+                        if(objects[i]->intersect(r, ray_t, hit))
+                        {
+                            hit_anything = true;
+                            ray_t.max = hit.t;
+                        }
+                    }
+                    continue;
+                }
+
+                const node& n = nodes[e.index];
+                alignas(32) float tnear[W];
+                int mask = intersect_children(n, rd, ray_t, tnear);
+
+                //Push the entered children farthest first, so the nearest one is processed next
+                int order[W];
+                int k = 0;
+                for(int i = 0; i < W; i++)
+                {
+                    if(!(mask & (1 << i))) continue;
+                    int j = k++;
+                    for(; j > 0 && tnear[order[j - 1]] < tnear[i]; j--)
+                        order[j] = order[j - 1];
+                    order[j] = i;
+                }
+                for(int j = 0; j < k; j++)
+                {
+                    int i = order[j];
+                    stack[top++] = entry{n.child[i], n.count[i], tnear[i]};
+                }
+            }
+            return hit_anything;
+        }
+        struct ray_data
+        {
+            float orig[3];
+            float inv_dir[3];
+            bool negative[3]; //Direction sign per axis, decides which slab plane is the near one
+
+            ray_data(const ray& r)
+            {
+                for(int a = 0; a < 3; a++)
+                {
+                    orig[a] = static_cast<float>(r.origin()[a]);
+                    inv_dir[a] = static_cast<float>(1 / r.direction()[a]);
+                    negative[a] = inv_dir[a] < 0;
+                }
+            }
+        };
+
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<node> nodes;
+        aabb bbox;
+
+        //Float bounds rounded outwards, so the boxes never shrink below the double precision ones
+        static float round_down(double v)
+        {
+            float f = static_cast<float>(v);
+            return (f > v) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+        }
+
+        static float round_up(double v)
+        {
+            float f = static_cast<float>(v);
+            return (f < v) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+        }
+
+        int collapse(const std::vector<bvh_node::node>& binary, int root)
+        {
+            //Open the largest inner child until the node is full
+            int kids[W];
+            int n_kids = 0;
+            if(binary[root].count > 0)
+                kids[n_kids++] = root;
+            else
+            {
+                kids[n_kids++] = binary[root].start;
+                kids[n_kids++] = binary[root].start + 1;
+            }
+
+            while(n_kids < W)
+            {
+                int best = -1;
+                double best_area = -1;
+                for(int i = 0; i < n_kids; i++)
+                {
+                    const auto& b = binary[kids[i]];
+                    if(b.count == 0 && b.bbox.surface_area() > best_area)
+                    {
+                        best = i;
+                        best_area = b.bbox.surface_area();
+                    }
+                }
+                if(best < 0) break;
+
+                int opened = kids[best];
+                kids[best] = binary[opened].start;
+                kids[n_kids++] = binary[opened].start + 1;
+            }
+
+            int index = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+            for(int a = 0; a < 3; a++)
+            {
+                for(int i = 0; i < W; i++)
+                {
+                    nodes[index].lo[a][i] = static_cast<float>(infinity);
+                    nodes[index].hi[a][i] = -static_cast<float>(infinity);
+                }
+            }
+            for(int i = 0; i < W; i++)
+            {
+                nodes[index].child[i] = 0;
+                nodes[index].count[i] = 0;
+            }
+
+            for(int i = 0; i < n_kids; i++)
+            {
+                const auto& b = binary[kids[i]];
+                for(int a = 0; a < 3; a++)
+                {
+                    nodes[index].lo[a][i] = round_down(b.bbox.axis(a).min);
+                    nodes[index].hi[a][i] = round_up(b.bbox.axis(a).max);
+                }
+
+                if(b.count > 0)
+                {
+                    nodes[index].child[i] = b.start;
+                    nodes[index].count[i] = b.count;
+                }
+                else
+                {
+                    int child = collapse(binary, kids[i]);
+                    nodes[index].child[i] = child; //nodes may have grown, index again
+                }
+            }
+            return index;
+        }
+
+        //Bitmask of the children some ray of the packet may enter before tmax, with lower bounds of the entry
+        //distances in tnear. Each slab distance is bounded by its products at the corners of the origin and
+        //inverse direction bounds; the single precision rounding is monotone, so the bounds hold per lane too.
+        static int intersect_children(const node& n, const ray_packet& p, float tmax, float* tnear)
+        {
+            float tmin = static_cast<float>(p.tmin);
+            tmax *= 1.0000004f;
+#if defined(RAY_SSE)
+            int mask = 0;
+            for(int k = 0; k < W; k += 4)
+            {
+                __m128 t0 = _mm_set1_ps(tmin);
+                __m128 t1 = _mm_set1_ps(tmax);
+                for(int a = 0; a < 3; a++)
+                {
+                    __m128 lo = _mm_load_ps(n.lo[a] + k);
+                    __m128 hi = _mm_load_ps(n.hi[a] + k);
+                    __m128 near_plane = p.negative[a] ? hi : lo;
+                    __m128 far_plane = p.negative[a] ? lo : hi;
+                    __m128 o0 = _mm_set1_ps(p.org_lo[a]), o1 = _mm_set1_ps(p.org_hi[a]);
+                    __m128 i0 = _mm_set1_ps(p.inv_lo[a]), i1 = _mm_set1_ps(p.inv_hi[a]);
+                    __m128 n0 = _mm_sub_ps(near_plane, o0), n1 = _mm_sub_ps(near_plane, o1);
+                    __m128 f0 = _mm_sub_ps(far_plane, o0), f1 = _mm_sub_ps(far_plane, o1);
+                    __m128 near_t = _mm_min_ps(_mm_min_ps(_mm_mul_ps(n0, i0), _mm_mul_ps(n0, i1)),
+                                               _mm_min_ps(_mm_mul_ps(n1, i0), _mm_mul_ps(n1, i1)));
+                    __m128 far_t = _mm_max_ps(_mm_max_ps(_mm_mul_ps(f0, i0), _mm_mul_ps(f0, i1)),
+                                              _mm_max_ps(_mm_mul_ps(f1, i0), _mm_mul_ps(f1, i1)));
+                    t0 = _mm_max_ps(near_t, t0);
+                    t1 = _mm_min_ps(far_t, t1);
+                }
+                _mm_store_ps(tnear + k, t0);
+                mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << k;
+            }
+            return mask;
+#else
+            int mask = 0;
+            for(int i = 0; i < W; i++)
+            {
+                float t0 = tmin, t1 = tmax;
+                for(int a = 0; a < 3; a++)
+                {
+                    float near_plane = p.negative[a] ? n.hi[a][i] : n.lo[a][i];
+                    float far_plane = p.negative[a] ? n.lo[a][i] : n.hi[a][i];
+                    float near_t = std::min(std::min((near_plane - p.org_lo[a]) * p.inv_lo[a], (near_plane - p.org_lo[a]) * p.inv_hi[a]),
+                                            std::min((near_plane - p.org_hi[a]) * p.inv_lo[a], (near_plane - p.org_hi[a]) * p.inv_hi[a]));
+                    float far_t = std::max(std::max((far_plane - p.org_lo[a]) * p.inv_lo[a], (far_plane - p.org_lo[a]) * p.inv_hi[a]),
+                                           std::max((far_plane - p.org_hi[a]) * p.inv_lo[a], (far_plane - p.org_hi[a]) * p.inv_hi[a]));
+                    t0 = near_t > t0 ? near_t : t0;
+                    t1 = far_t < t1 ? far_t : t1;
+                }
+                tnear[i] = t0;
+                if(t0 <= t1) mask |= 1 << i;
+            }
+            return mask;
+#endif
+        }
+
+        //Returns the bitmask of children the ray enters within ray_t, with their entry distances in tnear.
+        //Empty slots always miss: with the near plane picked by direction sign their entry is +infinity.
+        static int intersect_children(const node& n, const ray_data& rd, const interval& ray_t, float* tnear)
+        {
+            //Widen the far distance by a few ulps to absorb the single precision rounding of the slab distances
+            float tmin = static_cast<float>(ray_t.min);
+            float tmax = static_cast<float>(ray_t.max) * 1.0000004f;
+#if defined(RAY_AVX2_DISPATCH)
+            if constexpr(W == 8)
+            {
+                if(cpu_has_avx2())
+                    return intersect_children_avx2(n, rd, tmin, tmax, tnear);
+            }
+#endif
+#if defined(RAY_SSE)
+            int mask = 0;
+            for(int k = 0; k < W; k += 4)
+            {
+                __m128 t0 = _mm_set1_ps(tmin);
+                __m128 t1 = _mm_set1_ps(tmax);
+                for(int a = 0; a < 3; a++)
+                {
+                    __m128 lo = _mm_load_ps(n.lo[a] + k);
+                    __m128 hi = _mm_load_ps(n.hi[a] + k);
+                    __m128 o = _mm_set1_ps(rd.orig[a]);
+                    __m128 inv = _mm_set1_ps(rd.inv_dir[a]);
+                    __m128 near_t = _mm_mul_ps(_mm_sub_ps(rd.negative[a] ? hi : lo, o), inv);
+                    __m128 far_t = _mm_mul_ps(_mm_sub_ps(rd.negative[a] ? lo : hi, o), inv);
+                    t0 = _mm_max_ps(near_t, t0);
+                    t1 = _mm_min_ps(far_t, t1);
+                }
+                _mm_store_ps(tnear + k, t0);
+                mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << k;
+            }
+            return mask;
+#else
+            int mask = 0;
+            for(int i = 0; i < W; i++)
+            {
+                float t0 = tmin, t1 = tmax;
+                for(int a = 0; a < 3; a++)
+                {
+                    float near_t = ((rd.negative[a] ? n.hi[a][i] : n.lo[a][i]) - rd.orig[a]) * rd.inv_dir[a];
+                    float far_t = ((rd.negative[a] ? n.lo[a][i] : n.hi[a][i]) - rd.orig[a]) * rd.inv_dir[a];
+                    t0 = near_t > t0 ? near_t : t0;
+                    t1 = far_t < t1 ? far_t : t1;
+                }
+                tnear[i] = t0;
+                if(t0 <= t1) mask |= 1 << i;
+            }
+            return mask;
+#endif
+        }
+
+#if defined(RAY_AVX2_DISPATCH)
+        //All eight children of a wide node in one AVX slab test, called when cpu_has_avx2() says so
+        RAY_TARGET_AVX2 static int intersect_children_avx2(const node& n, const ray_data& rd, float tmin, float tmax, float* tnear)
+        {
+            __m256 t0 = _mm256_set1_ps(tmin);
+            __m256 t1 = _mm256_set1_ps(tmax);
+            for(int a = 0; a < 3; a++)
+            {
+                __m256 lo = _mm256_load_ps(n.lo[a]);
+                __m256 hi = _mm256_load_ps(n.hi[a]);
+                __m256 o = _mm256_set1_ps(rd.orig[a]);
+                __m256 inv = _mm256_set1_ps(rd.inv_dir[a]);
+                __m256 near_t = _mm256_mul_ps(_mm256_sub_ps(rd.negative[a] ? hi : lo, o), inv);
+                __m256 far_t = _mm256_mul_ps(_mm256_sub_ps(rd.negative[a] ? lo : hi, o), inv);
+                t0 = _mm256_max_ps(near_t, t0); //NaN slab distances keep the running value
+                t1 = _mm256_min_ps(far_t, t1);
+            }
+            _mm256_store_ps(tnear, t0);
+            return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+        }
+#endif
+};
+
+#endif
\ No newline at end of file
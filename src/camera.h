@@ -4,6 +4,7 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "material.h"
+#include "sampler.h"
 
 #include <condition_variable>
 #include <iostream>
@@ -16,6 +17,9 @@ class camera
         int image_width = 100;
         int samples_per_pixel = 10;
         int max_depth = 10;
+        int roulette_depth = 0; //Bounces after which Russian roulette may end a path, 0 (the default) turns it off
+        int frame = 0; //Part of the random stream seed, so each frame gets its own noise
+        sampler_type sampling = sampler_type::independent; //Generator for the pixel, lens and bounce dimensions
 
         double vfov = 90; //Vectical view angle
         point3 lookfrom = point3(0,0,-1); //Point camera is looking from
@@ -70,53 +74,93 @@ class camera
             defocus_disk_v = v * defocus_radius;
         }
 
-        ray get_ray(int i, int j) const
+        ray get_ray(int i, int j, sampler& s) const
         {
             //Ray with random sampling
-            auto pixel_centre = pixel00_loc + (i*pixel_delta_u) + (j*pixel_delta_v);
-            auto pixel_sample = pixel_centre + pixel_sample_square();
+            auto pixel_centre = mul_add(j, pixel_delta_v, mul_add(i, pixel_delta_u, pixel00_loc));
+            s.set_dimension(sampler::pixel_dimension);
+            auto pixel_sample = pixel_centre + pixel_sample_square(s.get_2d());
 
-            auto ray_origin = (defocus_angle <= 0) ? centre : defocus_disk_sample();
+            auto ray_origin = (defocus_angle <= 0) ? centre : defocus_disk_sample(s.get_2d());
             auto ray_direction = pixel_sample - ray_origin;
 
             return ray(ray_origin, ray_direction);
         }
 
-        vec3 pixel_sample_square() const
+        vec3 pixel_sample_square(const sample_2d& u) const
         {
             //Return a random point in the square surrounding the pixel with the origin of pixel as centre
-            auto px = -0.5 + random_double();
-            auto py = -0.5 + random_double();
-            return (px * pixel_delta_u) + (py * pixel_delta_v);
+            auto px = -0.5 + u.u;
+            auto py = -0.5 + u.v;
+            return mul_add(py, pixel_delta_v, px * pixel_delta_u);
         }
 
-        point3 defocus_disk_sample() const
+        point3 defocus_disk_sample(const sample_2d& u) const
         {
-            auto p = random_in_unit_disk();
-            return centre + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
+            auto p = square_to_unit_disk(u.u, u.v);
+            return mul_add(p[1], defocus_disk_v, mul_add(p[0], defocus_disk_u, centre));
         }
 
-        color ray_color(const ray& r, int depth, const hittable& world)
+        //Follows the path bounce by bounce, carrying the product of the attenuations so far.
+        //Past roulette_depth bounces a path survives with probability of its largest throughput channel
+        //(at most 0.95) and is reweighted by its inverse, so dim paths end early without biasing the mean.
+        //segments, when given, is increased by the number of rays traced.
+        color ray_color(const ray& r, const hittable& world, const material_table& materials, sampler& s,
+                        long long* segments = nullptr) const
         {
-            if(depth <= 0)
-            {
-                return color(0,0,0);
-            }
-            hit_record rec;
-            if(world.hit(r, interval(0.001, infinity), rec))
+            ray current = r;
+            color throughput(1,1,1);
+            color result(0,0,0);
+            int bounce = 0;
+            for(; bounce < max_depth; bounce++)
             {
+                hit_record rec;
+                if(!world.hit(current, interval(ray_tmin, infinity), rec))
+                {
+                    result = throughput * background(current);
+                    bounce++;
+                    break;
+                }
+
                 ray scattered;
                 color attenuation;
-                if(rec.mat->scatter(r, rec, attenuation, scattered))
+                s.set_dimension(sampler::first_bounce_dimension + bounce);
+                if(!materials[rec.mat].scatter(current, rec, attenuation, scattered, s))
+                {
+                    bounce++;
+                    break;
+                }
+                throughput = throughput * attenuation;
+                current = scattered;
+                if(!survives_roulette(throughput, bounce, s))
                 {
-                    return attenuation * ray_color(scattered, depth-1, world);
+                    bounce++;
+                    break;
                 }
-                return color(0,0,0);
             }
+            if(segments) *segments += bounce;
+            return result;
+        }
+
+        color background(const ray& r) const
+        {
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.9*(unit_direction.y() + 1.0);
             return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5,0.7,1.0); //Background color for the image using Linear Interpolation
         }
+
+        //Russian roulette after scattering at bounce; reweights the throughput of a surviving path
+        bool survives_roulette(color& throughput, int bounce, sampler& s) const
+        {
+            if(roulette_depth <= 0 || bounce + 1 < roulette_depth)
+                return true;
+            double survive = std::fmin(0.95, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+            s.set_dimension(sampler::first_bounce_dimension + max_depth + bounce); //Past the scatter dimensions
+            if(s.get_1d() >= survive)
+                return false;
+            throughput /= survive;
+            return true;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Streaming DEFLATE (RFC 1951) compressor: greedy LZ77 over a 32 KB window with hash chains,
+//coded as one block with the fixed Huffman tables. Input is fed with write() in any sized pieces,
+//compressed bytes are taken from output() as they appear.
+class deflate_encoder
+{
+    public:
+        deflate_encoder() : head(hash_size, -1), prev(window_size, -1)
+        {
+            put_bits(1, 1); //Final block
+            put_bits(1, 2); //Fixed Huffman codes
+        }
+
+        void write(const uint8_t* data, size_t n)
+        {
+            input.insert(input.end(), data, data + n);
+            compress(false);
+        }
+
+        //Compresses what is left and ends the stream
+        void finish()
+        {
+            compress(true);
+            put_symbol(256);
+            if(bit_count > 0)
+                out.push_back(static_cast<uint8_t>(bit_buffer));
+            bit_buffer = 0;
+            bit_count = 0;
+        }
+
+        //Compressed bytes produced so far; the caller may take and clear them
+        std::vector<uint8_t>& output() { return out; }
+
+    private:
+        static const int window_size = 32768;
+        static const int hash_bits = 15;
+        static const int hash_size = 1 << hash_bits;
+        static const int min_match = 3;
+        static const int max_match = 258;
+        static const int max_chain = 32; //Candidates tried per position
+
+        std::vector<uint8_t> input; //Window behind pos plus the lookahead
+        int64_t base = 0; //Stream position of input[0], 64 bit so streams past 2 GB work where long is 32 bit
+        int64_t pos = 0;  //Stream position of the next byte to code
+        std::vector<int64_t> head; //Latest stream position per hash
+        std::vector<int64_t> prev; //Previous position with the same hash, indexed by position modulo the window
+        uint64_t bit_buffer = 0;
+        int bit_count = 0;
+        std::vector<uint8_t> out;
+
+        uint8_t at(int64_t p) const { return input[p - base]; }
+
+        int hash(int64_t p) const
+        {
+            return ((at(p) << 10) ^ (at(p + 1) << 5) ^ at(p + 2)) & (hash_size - 1);
+        }
+
+        void insert(int64_t p)
+        {
+            int h = hash(p);
+            prev[p & (window_size - 1)] = head[h];
+            head[h] = p;
+        }
+
+        void compress(bool final)
+        {
+            int64_t end = base + static_cast<int64_t>(input.size());
+            while(pos < end)
+            {
+                int64_t avail = end - pos;
+                if(!final && avail < max_match)
+                    break; //Wait for more input so matches can run to full length
+
+                int best_len = 0;
+                int64_t best_dist = 0;
+                if(avail >= min_match)
+                {
+                    int limit = static_cast<int>(avail < max_match ? avail : max_match);
+                    int64_t candidate = head[hash(pos)];
+                    for(int chain = 0; chain < max_chain && candidate >= 0 && pos - candidate <= window_size; chain++)
+                    {
+                        int len = 0;
+                        while(len < limit && at(candidate + len) == at(pos + len))
+                            len++;
+                        if(len > best_len)
+                        {
+                            best_len = len;
+                            best_dist = pos - candidate;
+                            if(len == limit) break;
+                        }
+                        candidate = prev[candidate & (window_size - 1)];
+                    }
+                    insert(pos);
+                }
+
+                if(best_len >= min_match)
+                {
+                    put_match(best_len, static_cast<int>(best_dist));
+                    for(int64_t p = pos + 1; p < pos + best_len && p + min_match <= end; p++)
+                        insert(p);
+                    pos += best_len;
+                }
+                else
+                {
+                    put_symbol(at(pos));
+                    pos++;
+                }
+            }
+
+            //Keep one window behind pos
+            if(pos - base > 2 * window_size)
+            {
+                int64_t drop = pos - window_size - base;
+                input.erase(input.begin(), input.begin() + drop);
+                base += drop;
+            }
+        }
+
+        void put_bits(uint32_t value, int n)
+        {
+            bit_buffer |= static_cast<uint64_t>(value) << bit_count;
+            bit_count += n;
+            while(bit_count >= 8)
+            {
+                out.push_back(static_cast<uint8_t>(bit_buffer));
+                bit_buffer >>= 8;
+                bit_count -= 8;
+            }
+        }
+
+        //Huffman codes are stored most significant bit first
+        void put_code(uint32_t code, int n)
+        {
+            uint32_t reversed = 0;
+            for(int i = 0; i < n; i++)
+                reversed |= ((code >> i) & 1) << (n - 1 - i);
+            put_bits(reversed, n);
+        }
+
+        void put_symbol(int s) //Literal/length alphabet, fixed code lengths
+        {
+            if(s <= 143) put_code(0x30 + s, 8);
+            else if(s <= 255) put_code(0x190 + (s - 144), 9);
+            else if(s <= 279) put_code(s - 256, 7);
+            else put_code(0xc0 + (s - 280), 8);
+        }
+
+        void put_match(int len, int dist)
+        {
+            static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static const int dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                              257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                              8193, 12289, 16385, 24577};
+            static const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                               7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+            int l = 28;
+            while(length_base[l] > len) l--;
+            put_symbol(257 + l);
+            put_bits(len - length_base[l], length_extra[l]);
+
+            int d = 29;
+            while(dist_base[d] > dist) d--;
+            put_code(d, 5);
+            put_bits(dist - dist_base[d], dist_extra[d]);
+        }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "vec3.h"
+#include "mapped_file.h"
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Linear pixel colours of one image, row major from the top left.
+//Render workers write their disjoint tiles straight into it, so finishing a tile needs no copy or lock.
+//Only resident_rows rows are stored at a time: row j lives in slot j % resident_rows, so a streaming
+//render can reuse the slots of rows already written out. The slots can also live in a memory-mapped file.
+class framebuffer
+{
+    public:
+        //resident_rows 0 keeps the whole image; an empty backing_file keeps the pixels in RAM
+        framebuffer(int w, int h, int resident_rows = 0, const std::string& backing_file = "")
+        : w(w), h(h), resident(resident_rows > 0 && resident_rows < h ? resident_rows : h)
+        {
+            size_t count = static_cast<size_t>(w) * resident;
+            if(!backing_file.empty())
+            {
+                if(mapping.open(backing_file, count * sizeof(color)))
+                    pixels = static_cast<color*>(mapping.data()); //Zero filled, like the vector
+                else
+                    std::clog << "Cannot map " << backing_file << ", keeping the framebuffer in memory\n";
+            }
+            if(!pixels)
+            {
+                storage.resize(count);
+                pixels = storage.data();
+            }
+        }
+
+        framebuffer(const framebuffer&) = delete;
+        framebuffer& operator=(const framebuffer&) = delete;
+
+        int width() const { return w; }
+        int height() const { return h; }
+        int resident_rows() const { return resident; }
+
+        color& at(int i, int j) { return pixels[slot(j) + i]; }
+        const color& at(int i, int j) const { return pixels[slot(j) + i]; }
+
+        const color* row(int j) const { return &pixels[slot(j)]; }
+
+    private:
+        int w;
+        int h;
+        int resident;
+        std::vector<color> storage;
+        mapped_file mapping;
+        color* pixels = nullptr;
+
+        size_t slot(int j) const { return static_cast<size_t>(j % resident) * w; }
+};
+
+//Running per-pixel sums of radiance samples for progressive rendering, in single precision.
+//Pixels may hold different sample counts, so a render cut short still resolves to an unbiased image.
+//With track_variance, samples added one at a time also accumulate their squared luminance, from which the variance follows.
+class accumulation_buffer
+{
+    public:
+        accumulation_buffer(int w, int h, bool track_variance = false)
+        : w(w), sum(static_cast<size_t>(w) * h * 3, 0), count(static_cast<size_t>(w) * h, 0),
+          luminance_sq(track_variance ? static_cast<size_t>(w) * h : 0, 0) {}
+
+        //Adds one sample and tracks its luminance for error(); needs track_variance.
+        //Workers call this concurrently on their own pixels, so nothing here may resize.
+        void add_sample(int i, int j, const color& sample)
+        {
+            size_t p = static_cast<size_t>(j) * w + i;
+            double y = luminance(sample);
+            luminance_sq[p] += y * y;
+            add(i, j, sample, 1);
+        }
+
+        //Adds the sum of n samples
+        void add(int i, int j, const color& samples, int n)
+        {
+            size_t p = static_cast<size_t>(j) * w + i;
+            for(int c = 0; c < 3; c++)
+                sum[3 * p + c] += static_cast<float>(samples[c]);
+            count[p] += n;
+        }
+
+        int samples(int i, int j) const { return count[static_cast<size_t>(j) * w + i]; }
+
+        color mean(int i, int j) const
+        {
+            size_t p = static_cast<size_t>(j) * w + i;
+            if(count[p] == 0) return color(0, 0, 0);
+            return color(sum[3 * p], sum[3 * p + 1], sum[3 * p + 2]) / count[p];
+        }
+
+        //Standard error of the pixel mean in display units (the writers' gamma 2 curve), from samples added
+        //with add_sample. Perceived noise shrinks in bright pixels, so this is what stopping should look at.
+        double error(int i, int j) const
+        {
+            size_t p = static_cast<size_t>(j) * w + i;
+            uint32_t n = count[p];
+            if(n < 2 || luminance_sq.empty()) return INFINITY;
+            double mean = luminance(color(sum[3 * p], sum[3 * p + 1], sum[3 * p + 2])) / n;
+            double variance = std::fmax(0.0, (luminance_sq[p] / n - mean * mean) * n / (n - 1));
+            return std::sqrt(variance / n) / (2 * std::sqrt(std::fmax(mean, 0.0)) + 1e-3);
+        }
+
+    private:
+        int w;
+        std::vector<float> sum;
+        std::vector<uint32_t> count;
+        std::vector<double> luminance_sq; //Empty without track_variance
+
+        static double luminance(const color& c) { return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z(); }
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef GRID_ACCEL_H
+#define GRID_ACCEL_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+//Uniform grid over a set of hittables, traversed cell by cell with a 3D-DDA.
+//Objects far larger than the typical one (like a ground sphere) are kept out of the grid and tested for every ray,
+//so they neither stretch the grid bounds nor land in every cell.
+class grid_accel : public hittable
+{
+    public:
+        //density is the target number of objects per cell
+        grid_accel(const hittable_list& list, double density = 2.0, bool report = false)
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            build(list.objects, density);
+            auto build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if(report)
+            {
+                std::clog << "Grid build: " << res[0] << "x" << res[1] << "x" << res[2] << " cells, "
+                          << cell_items.size() << " references, " << large.size() << " large objects, "
+                          << build_ms << " ms\n";
+            }
+        }
+
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
+        {
+            bool hit_anything = false;
+            for(const auto& object : large)
+            {
+                if(object->intersect(r, ray_t, hit))
+                {
+                    hit_anything = true;
+                    ray_t.max = hit.t;
+                }
+            }
+            if(cell_items.empty()) return hit_anything;
+
+            //Clip the ray to the grid bounds
+            point3 orig = r.origin();
+            vec3 dir = r.direction();
+            auto t_enter = ray_t.min, t_exit = ray_t.max;
+            for(int a = 0; a < 3; a++)
+            {
+                auto inv = 1 / dir[a];
+                auto t0 = (bounds.axis(a).min - orig[a]) * inv;
+                auto t1 = (bounds.axis(a).max - orig[a]) * inv;
+                if(inv < 0) std::swap(t0, t1);
+                t_enter = t0 > t_enter ? t0 : t_enter;
+                t_exit = t1 < t_exit ? t1 : t_exit;
+                if(t_exit < t_enter) return hit_anything;
+            }
+
+            //Set up the DDA: current cell, distance to the next boundary and between boundaries on each axis
+            point3 p = r.at(t_enter);
+            int cell[3], step[3], out[3];
+            double next_t[3], delta_t[3];
+            for(int a = 0; a < 3; a++)
+            {
+                auto lo = bounds.axis(a).min;
+                cell[a] = std::clamp(static_cast<int>((p[a] - lo) / cell_size[a]), 0, res[a] - 1);
+                if(dir[a] > 0)
+                {
+                    step[a] = 1;
+                    out[a] = res[a];
+                    next_t[a] = t_enter + (lo + (cell[a] + 1) * cell_size[a] - p[a]) / dir[a];
+                    delta_t[a] = cell_size[a] / dir[a];
+                }
+                else if(dir[a] < 0)
+                {
+                    step[a] = -1;
+                    out[a] = -1;
+                    next_t[a] = t_enter + (lo + cell[a] * cell_size[a] - p[a]) / dir[a];
+                    delta_t[a] = -cell_size[a] / dir[a];
+                }
+                else
+                {
+                    step[a] = 0;
+                    out[a] = -1;
+                    next_t[a] = infinity;
+                    delta_t[a] = infinity;
+                }
+            }
+
+            while(true)
+            {
+                int index = cell[0] + res[0] * (cell[1] + res[1] * cell[2]);
+                for(int i = cell_start[index]; i < cell_start[index + 1]; i++)
+                {
+                    if(objects[cell_items[i]]->intersect(r, ray_t, hit))
+                    {
+                        hit_anything = true;
+                        ray_t.max = hit.t;
+                    }
+                }
+
+                //A hit inside this cell is closer than anything in the cells behind it
+                int axis = next_t[0] < next_t[1] ? (next_t[0] < next_t[2] ? 0 : 2) : (next_t[1] < next_t[2] ? 1 : 2);
+                auto cell_exit = next_t[axis];
+                if(cell_exit >= ray_t.max || cell_exit >= t_exit)
+                    break;
+
+                cell[axis] += step[axis];
+                if(cell[axis] == out[axis])
+                    break;
+                next_t[axis] += delta_t[axis];
+            }
+            return hit_anything;
+        }
+
+        aabb bounding_box() const override { return bbox; }
+
+        void bind_materials(material_table& table) override
+        {
+            for(const auto& object : large)
+                object->bind_materials(table);
+            for(const auto& object : objects)
+                object->bind_materials(table);
+        }
+
+    private:
+        std::vector<shared_ptr<hittable>> objects; //Objects binned into the grid
+        std::vector<shared_ptr<hittable>> large;   //Objects tested for every ray
+        std::vector<int> cell_start;               //Offsets into cell_items, one past the end for the last cell
+        std::vector<int> cell_items;               //Object indices, grouped by cell
+        aabb bounds;                               //Grid bounds
+        aabb bbox;                                 //Bounds of every object, large ones included
+        int res[3] = {0, 0, 0};
+        double cell_size[3] = {0, 0, 0};
+
+        static const int max_resolution = 512;
+        static constexpr double large_factor = 16; //Objects wider than this many median widths stay out of the grid
+
+        static double max_extent(const aabb& box)
+        {
+            return std::max(box.x.size(), std::max(box.y.size(), box.z.size()));
+        }
+
+        void build(const std::vector<shared_ptr<hittable>>& src_objects, double density)
+        {
+            if(src_objects.empty()) return;
+
+            std::vector<double> extents;
+            extents.reserve(src_objects.size());
+            for(const auto& object : src_objects)
+            {
+                extents.push_back(max_extent(object->bounding_box()));
+                bbox = aabb(bbox, object->bounding_box());
+            }
+            auto median = extents.begin() + extents.size() / 2;
+            std::nth_element(extents.begin(), median, extents.end());
+            auto limit = large_factor * *median;
+
+            for(const auto& object : src_objects)
+            {
+                auto box = object->bounding_box();
+                if(max_extent(box) > limit)
+                    large.push_back(object);
+                else
+                {
+                    objects.push_back(object);
+                    bounds = aabb(bounds, box);
+                }
+            }
+            if(objects.empty()) return;
+
+            //Pad flat axes so every cell has a volume, then aim for `density` objects per cell
+            auto pad = 1e-4 * max_extent(bounds) + 1e-9;
+            bounds = aabb(bounds.x.size() < pad ? bounds.x.expand(pad) : bounds.x,
+                          bounds.y.size() < pad ? bounds.y.expand(pad) : bounds.y,
+                          bounds.z.size() < pad ? bounds.z.expand(pad) : bounds.z);
+            auto volume = bounds.x.size() * bounds.y.size() * bounds.z.size();
+            auto cells_per_unit = std::cbrt(objects.size() / (density * volume));
+            for(int a = 0; a < 3; a++)
+            {
+                res[a] = std::clamp(static_cast<int>(std::round(bounds.axis(a).size() * cells_per_unit)), 1, max_resolution);
+                cell_size[a] = bounds.axis(a).size() / res[a];
+            }
+
+            //Count references per cell, turn the counts into offsets, then fill
+            int cell_count = res[0] * res[1] * res[2];
+            cell_start.assign(cell_count + 1, 0);
+            for(int pass = 0; pass < 2; pass++)
+            {
+                std::vector<int> fill;
+                if(pass == 1)
+                {
+                    for(int c = 0; c < cell_count; c++)
+                        cell_start[c + 1] += cell_start[c];
+                    cell_items.resize(cell_start[cell_count]);
+                    fill.assign(cell_start.begin(), cell_start.end() - 1);
+                }
+
+                for(int i = 0; i < static_cast<int>(objects.size()); i++)
+                {
+                    int lo[3], hi[3];
+                    cell_range(objects[i]->bounding_box(), lo, hi);
+                    for(int z = lo[2]; z <= hi[2]; z++)
+                        for(int y = lo[1]; y <= hi[1]; y++)
+                            for(int x = lo[0]; x <= hi[0]; x++)
+                            {
+                                int index = x + res[0] * (y + res[1] * z);
+                                if(pass == 0)
+                                    cell_start[index + 1]++;
+                                else
+                                    cell_items[fill[index]++] = i;
+                            }
+                }
+            }
+        }
+
+        void cell_range(const aabb& box, int* lo, int* hi) const
+        {
+            for(int a = 0; a < 3; a++)
+            {
+                auto origin = bounds.axis(a).min;
+                lo[a] = std::clamp(static_cast<int>((box.axis(a).min - origin) / cell_size[a]), 0, res[a] - 1);
+                hi[a] = std::clamp(static_cast<int>((box.axis(a).max - origin) / cell_size[a]), 0, res[a] - 1);
+            }
+        }
+};
+
+#endif
\ No newline at end of file
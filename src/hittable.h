@@ -2,16 +2,20 @@
 #define HITTABLE_H
 
 #include "ray.h"
+#include "ray_packet.h"
 #include "rtweekend.h"
+#include "aabb.h"
 
-class material;
+#include <cstdint>
+
+class material_table;
 
 class hit_record
 {
     public:
         point3 p;
         vec3 normal;
-        shared_ptr<material> mat;
+        uint32_t mat; //Index into the scene's material_table
         double t;
         bool front_face;
 
@@ -24,11 +28,52 @@ class hit_record
         }
 };
 
+class hittable;
+
+class closest_hit //Result of the lean closest-hit query, surface data is evaluated once for the final hit
+{
+    public:
+        double t;
+        const hittable* object = nullptr; //Primitive that was hit, never a container
+        int index = 0; //Primitive within object, for objects holding several
+};
+
 class hittable
 {
     public:
         virtual ~hittable() = default;
-        virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+        //Closest hit within ray_t; hit is only written when this returns true
+        virtual bool intersect(const ray& r, interval ray_t, closest_hit& hit) const = 0;
+
+        //Full hit record for a hit this object reported. Containers never appear in closest_hit::object,
+        //so only primitives override this
+        virtual void surface_interaction(const ray&, const closest_hit&, hit_record&) const {}
+
+        //Closest hits of the packet lanes in `lanes`: a lane that hits gets hits[k] and a shorter p.tmax.
+        //Objects with a packet kernel override this, the rest trace lane by lane
+        virtual void intersect_packet(ray_packet& p, uint32_t lanes, closest_hit* hits) const
+        {
+            for(int k = 0; k < p.size; k++)
+            {
+                if((lanes & (1u << k)) && intersect(p.lane_ray(k), interval(p.tmin, p.tmax[k]), hits[k]))
+                    p.shorten(k, hits[k].t);
+            }
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const
+        {
+            closest_hit h;
+            if(!intersect(r, ray_t, h)) return false;
+            h.object->surface_interaction(r, h, rec);
+            return true;
+        }
+
+        virtual aabb bounding_box() const = 0;
+
+        //Registers the materials in the table so hit records can refer to them by index.
+        //Must run on the scene before rendering; containers forward it to their objects
+        virtual void bind_materials(material_table&) {}
 };
 
 #endif
\ No newline at end of file
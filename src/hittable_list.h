@@ -1,5 +1,5 @@
 #ifndef HITTABLE_LIST_H
-#define HITTALBE_LIST_H
+#define HITTABLE_LIST_H
 
 #include "hittable.h"
 
@@ -23,23 +23,41 @@ class hittable_list : public hittable
             objects.push_back(object);
         } 
 
-        bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
         {
-            hit_record temp_rec;
             bool hit_anything = false;
-            auto closest_so_far = ray_t.max;
 
             for(const auto& object : objects)
             {
-                if(object->hit(r, interval(ray_t.min, closest_so_far), temp_rec))
+                if(object->intersect(r, ray_t, hit))
                 {
                     hit_anything = true;
-                    closest_so_far = temp_rec.t;
-                    rec = temp_rec;
+                    ray_t.max = hit.t; //Closest so far
                 }
             }
             return hit_anything;
         }
+
+        void intersect_packet(ray_packet& p, uint32_t lanes, closest_hit* hits) const override
+        {
+            for(const auto& object : objects)
+                object->intersect_packet(p, lanes, hits); //Each narrows p.tmax for the next
+        }
+
+        //Gathered on every call rather than cached in add(), so objects moved since stay inside it
+        aabb bounding_box() const override
+        {
+            aabb bbox;
+            for(const auto& object : objects)
+                bbox = aabb(bbox, object->bounding_box());
+            return bbox;
+        }
+
+        void bind_materials(material_table& table) override
+        {
+            for(const auto& object : objects)
+                object->bind_materials(table);
+        }
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,132 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+
+#include "rtweekend.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Reads back the PPM (P3, P6 at 8 or 16 bit) and PFM images the writers produce, so renders can be compared.
+//Pixels come out top to bottom in display encoding, 0 to 1: PPM values as stored, PFM values through display_value().
+class image_reader
+{
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<color> pixels;
+
+        //False, with a message on std::clog, when the file is missing or not one of the formats
+        bool read(const std::string& path)
+        {
+            std::ifstream in(path, std::ios::binary);
+            if(!in)
+                return fail(path, "cannot be opened");
+            std::string magic;
+            in >> magic;
+            if(magic == "P3" || magic == "P6")
+                return read_ppm(in, path, magic == "P6");
+            if(magic == "PF")
+                return read_pfm(in, path);
+            return fail(path, "is not a P3/P6 PPM or an RGB PFM");
+        }
+
+    private:
+        bool fail(const std::string& path, const char* why)
+        {
+            std::clog << path << " " << why << "\n";
+            return false;
+        }
+
+        bool read_size(std::istream& in)
+        {
+            in >> width >> height;
+            return in && width > 0 && height > 0;
+        }
+
+        bool read_ppm(std::istream& in, const std::string& path, bool binary)
+        {
+            int max_value = 0;
+            if(!read_size(in) || !(in >> max_value) || max_value <= 0 || max_value > 65535)
+                return fail(path, "has a bad PPM header");
+            in.get(); //The single whitespace before binary samples
+            const bool wide = max_value > 255;
+            pixels.resize(static_cast<size_t>(width) * height);
+            for(auto& p : pixels)
+                for(int c = 0; c < 3; c++)
+                {
+                    int value = 0;
+                    if(!binary)
+                        in >> value;
+                    else if(wide)
+                    {
+                        uint8_t b[2];
+                        in.read(reinterpret_cast<char*>(b), 2);
+                        value = (b[0] << 8) | b[1];
+                    }
+                    else
+                        value = static_cast<uint8_t>(in.get());
+                    p[c] = double(value) / max_value;
+                }
+            return in ? true : fail(path, "ends early");
+        }
+
+        bool read_pfm(std::istream& in, const std::string& path)
+        {
+            double scale = 0;
+            if(!read_size(in) || !(in >> scale) || scale == 0)
+                return fail(path, "has a bad PFM header");
+            in.get();
+            const bool swap = scale > 0; //Positive scale: big endian
+            pixels.resize(static_cast<size_t>(width) * height);
+            for(int j = height - 1; j >= 0; j--) //Stored bottom to top
+                for(int i = 0; i < width; i++)
+                    for(int c = 0; c < 3; c++)
+                    {
+                        uint8_t b[4];
+                        in.read(reinterpret_cast<char*>(b), 4);
+                        if(swap)
+                            std::reverse(b, b + 4);
+                        float value;
+                        std::memcpy(&value, b, 4);
+                        pixels[static_cast<size_t>(j) * width + i][c] = display_value(value);
+                    }
+            return in ? true : fail(path, "ends early");
+        }
+};
+
+//Prints how far image b is from image a in 8 bit display levels: the RMSE, the largest difference and both means.
+//Returns false when either cannot be read or their sizes differ.
+inline bool compare_images(const std::string& path_a, const std::string& path_b)
+{
+    image_reader a, b;
+    if(!a.read(path_a) || !b.read(path_b))
+        return false;
+    if(a.width != b.width || a.height != b.height)
+    {
+        std::clog << "Sizes differ: " << a.width << "x" << a.height << " and " << b.width << "x" << b.height << "\n";
+        return false;
+    }
+
+    double sum_sq = 0, largest = 0, mean_a = 0, mean_b = 0;
+    for(size_t k = 0; k < a.pixels.size(); k++)
+        for(int c = 0; c < 3; c++)
+        {
+            double x = 255 * a.pixels[k][c], y = 255 * b.pixels[k][c];
+            sum_sq += (x - y) * (x - y);
+            largest = std::max(largest, fabs(x - y));
+            mean_a += x;
+            mean_b += y;
+        }
+    double n = 3.0 * a.pixels.size();
+    std::cout << "RMSE " << sqrt(sum_sq / n) << ", largest difference " << largest << ", means "
+        << mean_a / n << " and " << mean_b / n << " (8 bit display levels, " << a.width << "x" << a.height << ")\n";
+    return true;
+}
+
+#endif
@@ -0,0 +1,510 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "deflate.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class image_format
+{
+    p3,    //ASCII PPM
+    ppm,   //Binary PPM (P6), 8 bit
+    ppm16, //Binary PPM, 16 bit
+    png,   //8 bit RGB PNG
+    pfm,   //Linear float PFM
+    exr    //Linear float OpenEXR, uncompressed scanlines
+};
+
+//Format named by a -format argument, false when unknown
+inline bool parse_image_format(const std::string& name, image_format& format)
+{
+    if(name == "p3") format = image_format::p3;
+    else if(name == "ppm") format = image_format::ppm;
+    else if(name == "ppm16") format = image_format::ppm16;
+    else if(name == "png") format = image_format::png;
+    else if(name == "pfm") format = image_format::pfm;
+    else if(name == "exr") format = image_format::exr;
+    else return false;
+    return true;
+}
+
+//Format from the file extension, binary PPM when it is not one of the others
+inline image_format image_format_from_path(const std::string& path)
+{
+    auto dot = path.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+    image_format format = image_format::ppm;
+    if(ext != "ppm")
+        parse_image_format(ext, format);
+    return format;
+}
+
+//Display encoding of the integer formats: gamma 2, clamped below 1
+inline double display_value(double linear)
+{
+    static const interval intensity(0.000, 0.999);
+    return intensity.clamp(sqrt(linear));
+}
+
+inline uint8_t to_byte(double linear) { return static_cast<uint8_t>(255.99f * display_value(linear)); }
+
+//Encodes an image streamed in rows, top to bottom, from linear colour.
+//Output is gathered in a large buffer and handed to the stream in chunks.
+class image_writer
+{
+    public:
+        virtual ~image_writer() = default;
+
+        virtual void write_rows(const color* pixels, int rows) = 0;
+
+        //Call once after the last row
+        virtual void finish()
+        {
+            flush();
+            out.flush();
+        }
+
+    protected:
+        std::ostream& out;
+        int width;
+        int height;
+
+        image_writer(std::ostream& os, int w, int h) : out(os), width(w), height(h) {}
+
+        void put(const void* data, size_t n)
+        {
+            auto bytes = static_cast<const char*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + n);
+            if(buffer.size() >= chunk_size)
+                flush();
+        }
+
+        void put(const std::string& s) { put(s.data(), s.size()); }
+
+        void put_u32_le(uint32_t v)
+        {
+            uint8_t b[4] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)};
+            put(b, 4);
+        }
+
+        void put_u64_le(uint64_t v)
+        {
+            put_u32_le(static_cast<uint32_t>(v));
+            put_u32_le(static_cast<uint32_t>(v >> 32));
+        }
+
+        void put_float_le(float f)
+        {
+            uint32_t v;
+            std::memcpy(&v, &f, 4);
+            put_u32_le(v);
+        }
+
+        void flush()
+        {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+
+    private:
+        static const size_t chunk_size = 1 << 20;
+        std::vector<char> buffer;
+};
+
+class p3_writer : public image_writer
+{
+    public:
+        p3_writer(std::ostream& os, int w, int h) : image_writer(os, w, h)
+        {
+            put("P3\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n");
+        }
+
+        void write_rows(const color* pixels, int rows) override
+        {
+            char text[48];
+            for(int64_t i = 0; i < static_cast<int64_t>(rows) * width; i++)
+            {
+                int n = std::snprintf(text, sizeof(text), "%d %d %d\n",
+                                      to_byte(pixels[i][0]), to_byte(pixels[i][1]), to_byte(pixels[i][2]));
+                put(text, n);
+            }
+        }
+};
+
+class ppm_writer : public image_writer
+{
+    public:
+        ppm_writer(std::ostream& os, int w, int h, bool sixteen_bit) : image_writer(os, w, h), wide(sixteen_bit)
+        {
+            put("P6\n" + std::to_string(w) + " " + std::to_string(h) + (wide ? "\n65535\n" : "\n255\n"));
+        }
+
+        void write_rows(const color* pixels, int rows) override
+        {
+            row.clear();
+            for(int64_t i = 0; i < static_cast<int64_t>(rows) * width; i++)
+            {
+                for(int c = 0; c < 3; c++)
+                {
+                    if(wide) //Big endian samples
+                    {
+                        static const interval unit(0, 1);
+                        auto v = static_cast<uint16_t>(65535 * unit.clamp(sqrt(pixels[i][c])) + 0.5);
+                        row.push_back(static_cast<uint8_t>(v >> 8));
+                        row.push_back(static_cast<uint8_t>(v));
+                    }
+                    else
+                        row.push_back(to_byte(pixels[i][c]));
+                }
+            }
+            put(row.data(), row.size());
+        }
+
+    private:
+        bool wide;
+        std::vector<uint8_t> row;
+};
+
+class png_writer : public image_writer
+{
+    public:
+        png_writer(std::ostream& os, int w, int h) : image_writer(os, w, h), previous(3 * w, 0), current(3 * w)
+        {
+            static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            put(signature, 8);
+
+            std::vector<uint8_t> header;
+            put_u32_be(header, w);
+            put_u32_be(header, h);
+            header.insert(header.end(), {8, 2, 0, 0, 0}); //8 bit RGB, deflate, adaptive filters, not interlaced
+            put_chunk("IHDR", header);
+
+            idat = {0x78, 0x01}; //zlib header: deflate, 32 KB window
+        }
+
+        void write_rows(const color* pixels, int rows) override
+        {
+            for(int r = 0; r < rows; r++)
+            {
+                for(int i = 0; i < width; i++)
+                    for(int c = 0; c < 3; c++)
+                        current[3 * i + c] = to_byte(pixels[static_cast<int64_t>(r) * width + i][c]);
+                filter_row();
+                previous.swap(current);
+
+                auto& compressed = encoder.output();
+                idat.insert(idat.end(), compressed.begin(), compressed.end());
+                compressed.clear();
+                if(idat.size() >= idat_size)
+                {
+                    put_chunk("IDAT", idat);
+                    idat.clear();
+                }
+            }
+        }
+
+        void finish() override
+        {
+            encoder.finish();
+            auto& compressed = encoder.output();
+            idat.insert(idat.end(), compressed.begin(), compressed.end());
+            put_u32_be(idat, (adler_b << 16) | adler_a);
+            put_chunk("IDAT", idat);
+            put_chunk("IEND", {});
+            image_writer::finish();
+        }
+
+    private:
+        static const size_t idat_size = 1 << 16;
+        std::vector<uint8_t> previous, current;
+        std::vector<uint8_t> filtered[5];
+        std::vector<uint8_t> idat;
+        deflate_encoder encoder;
+        uint32_t adler_a = 1, adler_b = 0;
+
+        static void put_u32_be(std::vector<uint8_t>& v, uint32_t x)
+        {
+            v.insert(v.end(), {uint8_t(x >> 24), uint8_t(x >> 16), uint8_t(x >> 8), uint8_t(x)});
+        }
+
+        static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t n)
+        {
+            static const std::vector<uint32_t> table = []
+            {
+                std::vector<uint32_t> t(256);
+                for(uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t c = i;
+                    for(int k = 0; k < 8; k++)
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    t[i] = c;
+                }
+                return t;
+            }();
+            crc = ~crc;
+            for(size_t i = 0; i < n; i++)
+                crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return ~crc;
+        }
+
+        void put_chunk(const char* type, const std::vector<uint8_t>& data)
+        {
+            std::vector<uint8_t> head;
+            put_u32_be(head, static_cast<uint32_t>(data.size()));
+            head.insert(head.end(), type, type + 4);
+            put(head.data(), head.size());
+            put(data.data(), data.size());
+            uint32_t crc = crc32(crc32(0, head.data() + 4, 4), data.data(), data.size());
+            std::vector<uint8_t> tail;
+            put_u32_be(tail, crc);
+            put(tail.data(), tail.size());
+        }
+
+        static int paeth(int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+        }
+
+        //Tries every PNG filter and keeps the one with the smallest sum of absolute residuals
+        void filter_row()
+        {
+            int n = 3 * width;
+            int best = 0;
+            int64_t best_sum = -1;
+            for(int f = 0; f < 5; f++)
+            {
+                auto& out_row = filtered[f];
+                out_row.resize(n + 1);
+                out_row[0] = static_cast<uint8_t>(f);
+                int64_t sum = 0;
+                for(int i = 0; i < n; i++)
+                {
+                    int a = i >= 3 ? current[i - 3] : 0;
+                    int b = previous[i];
+                    int c = i >= 3 ? previous[i - 3] : 0;
+                    int predicted = f == 0 ? 0 : f == 1 ? a : f == 2 ? b : f == 3 ? (a + b) / 2 : paeth(a, b, c);
+                    auto residual = static_cast<uint8_t>(current[i] - predicted);
+                    out_row[i + 1] = residual;
+                    sum += residual < 128 ? residual : 256 - residual;
+                }
+                if(best_sum < 0 || sum < best_sum)
+                {
+                    best = f;
+                    best_sum = sum;
+                }
+            }
+
+            const auto& chosen = filtered[best];
+            for(uint8_t byte : chosen)
+            {
+                adler_a = (adler_a + byte) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+            encoder.write(chosen.data(), chosen.size());
+        }
+};
+
+//PFM stores rows bottom to top. On a seekable stream each batch of rows is written straight to its
+//place, which is one contiguous run; otherwise the rows are held until finish()
+class pfm_writer : public image_writer
+{
+    public:
+        pfm_writer(std::ostream& os, int w, int h) : image_writer(os, w, h)
+        {
+            put("PF\n" + std::to_string(w) + " " + std::to_string(h) + "\n-1.0\n"); //Negative scale: little endian
+            flush();
+            data_start = out.tellp();
+            if(!seekable())
+                rows_held.reserve(static_cast<size_t>(w) * h * 3);
+        }
+
+        bool seekable() const { return data_start != std::streampos(-1); }
+
+        void write_rows(const color* pixels, int rows) override
+        {
+            if(!seekable())
+            {
+                for(int64_t i = 0; i < static_cast<int64_t>(rows) * width; i++)
+                    for(int c = 0; c < 3; c++)
+                        rows_held.push_back(static_cast<float>(pixels[i][c]));
+                return;
+            }
+
+            rows_written += rows;
+            out.seekp(data_start + static_cast<std::streamoff>(height - rows_written) * width * 12);
+            for(int r = rows - 1; r >= 0; r--)
+                put_row(pixels + static_cast<int64_t>(r) * width);
+            flush();
+        }
+
+        void finish() override
+        {
+            for(int64_t r = static_cast<int64_t>(rows_held.size() / (3 * width)) - 1; r >= 0; r--)
+                for(int64_t k = 0; k < int64_t(3) * width; k++)
+                    put_float_le(rows_held[r * 3 * width + k]);
+            image_writer::finish();
+        }
+
+    private:
+        std::streampos data_start;
+        int rows_written = 0;
+        std::vector<float> rows_held;
+
+        void put_row(const color* row)
+        {
+            for(int i = 0; i < width; i++)
+                for(int c = 0; c < 3; c++)
+                    put_float_le(static_cast<float>(row[i][c]));
+        }
+};
+
+//Scanline OpenEXR with B, G, R float channels and no compression.
+//Every scanline has the same size, so the offset table is known before the first row
+class exr_writer : public image_writer
+{
+    public:
+        exr_writer(std::ostream& os, int w, int h) : image_writer(os, w, h)
+        {
+            std::string header;
+            auto u32 = [&header](uint32_t v) { for(int k = 0; k < 4; k++) header.push_back(static_cast<char>(v >> (8 * k))); };
+            auto f32 = [&u32](float f) { uint32_t v; std::memcpy(&v, &f, 4); u32(v); };
+            auto attribute = [&](const char* name, const char* type, uint32_t size)
+            {
+                header += name;
+                header.push_back(0);
+                header += type;
+                header.push_back(0);
+                u32(size);
+            };
+
+            u32(20000630); //Magic
+            u32(2);        //Version 2, single part scanline
+            attribute("channels", "chlist", 3 * 18 + 1);
+            for(const char* channel : {"B", "G", "R"})
+            {
+                header += channel;
+                header.push_back(0);
+                u32(2); //FLOAT
+                u32(0); //pLinear and reserved
+                u32(1); //x sampling
+                u32(1); //y sampling
+            }
+            header.push_back(0);
+            attribute("compression", "compression", 1);
+            header.push_back(0); //NO_COMPRESSION
+            for(const char* window : {"dataWindow", "displayWindow"})
+            {
+                attribute(window, "box2i", 16);
+                u32(0);
+                u32(0);
+                u32(w - 1);
+                u32(h - 1);
+            }
+            attribute("lineOrder", "lineOrder", 1);
+            header.push_back(0); //INCREASING_Y
+            attribute("pixelAspectRatio", "float", 4);
+            f32(1);
+            attribute("screenWindowCenter", "v2f", 8);
+            f32(0);
+            f32(0);
+            attribute("screenWindowWidth", "float", 4);
+            f32(1);
+            header.push_back(0);
+            put(header);
+
+            uint64_t line_size = 8 + 12 * static_cast<uint64_t>(w);
+            uint64_t first_line = header.size() + 8 * static_cast<uint64_t>(h);
+            for(int y = 0; y < h; y++)
+                put_u64_le(first_line + y * line_size);
+        }
+
+        void write_rows(const color* pixels, int rows) override
+        {
+            for(int r = 0; r < rows; r++, y++)
+            {
+                put_u32_le(static_cast<uint32_t>(y));
+                put_u32_le(static_cast<uint32_t>(12 * width));
+                const color* row = pixels + static_cast<int64_t>(r) * width;
+                for(int c = 2; c >= 0; c--)
+                    for(int i = 0; i < width; i++)
+                        put_float_le(static_cast<float>(row[i][c]));
+            }
+        }
+
+    private:
+        int y = 0;
+};
+
+inline std::unique_ptr<image_writer> make_image_writer(image_format format, std::ostream& out, int width, int height)
+{
+    switch(format)
+    {
+        case image_format::p3: return std::make_unique<p3_writer>(out, width, height);
+        case image_format::ppm: return std::make_unique<ppm_writer>(out, width, height, false);
+        case image_format::ppm16: return std::make_unique<ppm_writer>(out, width, height, true);
+        case image_format::png: return std::make_unique<png_writer>(out, width, height);
+        case image_format::pfm: return std::make_unique<pfm_writer>(out, width, height);
+        case image_format::exr: return std::make_unique<exr_writer>(out, width, height);
+    }
+    return nullptr;
+}
+
+//Output file, or stdout for an empty path
+class image_output
+{
+    public:
+        explicit image_output(const std::string& path)
+        {
+            if(path.empty())
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                stream = &std::cout;
+                return;
+            }
+            file.open(path, std::ios::binary);
+            if(file)
+                stream = &file;
+            else
+                std::clog << "Cannot open " << path << " for writing\n";
+        }
+
+        explicit operator bool() const { return stream != nullptr; }
+        std::ostream& get() { return *stream; }
+
+    private:
+        std::ofstream file;
+        std::ostream* stream = nullptr;
+};
+
+inline bool write_image(const framebuffer& image, const std::string& path, image_format format)
+{
+    image_output output(path);
+    if(!output)
+        return false;
+    auto writer = make_image_writer(format, output.get(), image.width(), image.height());
+    if(image.height() > 0)
+        writer->write_rows(image.row(0), image.height());
+    writer->finish();
+    return static_cast<bool>(output.get());
+}
+
+#endif
@@ -1,16 +1,29 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 
+#include <cmath>
 #include <limits>
 
 class interval
 {
     public:
         double min, max;
-        const double infinity = std::numeric_limits<double>::infinity(); 
+        static constexpr double infinity = std::numeric_limits<double>::infinity(); 
 
         interval() : min(+infinity), max(-infinity) {}
         interval(double _min, double _max) : min(_min) , max(_max) {} 
+        interval(const interval& a, const interval& b) //Interval enclosing both
+        : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
+
+        double size() const
+        {
+            return max - min;
+        }
+        interval expand(double delta) const
+        {
+            auto padding = delta/2;
+            return interval(min - padding, max + padding);
+        }
 
         bool contains(double x) const
         {
@@ -20,11 +33,10 @@ class interval
         {
             return min < x && x < max;
         }
-        double clamp(double x) const
+        double clamp(double x) const //Written as selects so it compiles to a max and a min, without branches
         {
-            if(x < min) return min;
-            if(x > max) return max;
-            return x;
+            double above = x < min ? min : x;
+            return above > max ? max : above;
         }
         // static const interval empty, universe;
 };
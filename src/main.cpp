@@ -4,7 +4,12 @@
 #include "material.h"
 #include "sphere.h"
 #include "hittable_list.h"
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "grid_accel.h"
+#include "sphere_set.h"
 #include "threadrender.h"
+#include "image_reader.h"
 
 #include <cstring>
 #include <string>
@@ -22,15 +27,115 @@
 #include <atomic>
 #include <queue>
 
-int main()
+int main(int argc, char* argv[])
 {
+    std::string accel = "bvh"; //bvh4 and bvh8 are opt-in
+    std::string prims = "spheres";
+    int image_width = 1200;
+    int samples_per_pixel = 10;
+    int roulette_depth = 0; //Off, -roulette opts in
+    int field = 11; //Small spheres are scattered over a (2*field)^2 grid
+    int frames = 1;  //Frames after the first bounce the small spheres and update the BVH instead of rebuilding it
+    std::string motion = "bounce"; //drift slides the small spheres across the field so the BVH update has to rebuild
+    sampler_type sampling = sampler_type::independent; //stratified, sobol and bluenoise are opt-in
+    render_settings render;
+    int threads = 0;
+    std::string output; //Empty writes to stdout
+    bool format_given = false;
+    std::string snapshot; //Progressive snapshots, rewritten after every pass
+    bvh_build_options build;
+    build.report = true;
+
+    //Options: -accel list|bvh|bvh4|bvh8|grid, -width <pixels>, -spp <samples per pixel>,
+    //-spheres <approximate count>, -build sah|lbvh, -build-threads <count>, -frames <count>, -motion bounce|drift,
+    //-prims spheres|soa (small spheres as sphere objects or in a sphere_set),
+    //-sampler independent|stratified|sobol|bluenoise, -tile <pixels>, -threads <count>,
+    //-o <path> (format from the extension), -format p3|ppm|ppm16|png|pfm|exr,
+    //-band <rows> (stream the image in bands), -framebuffer-file <path> (memory-mapped framebuffer),
+    //-pass-spp <samples> and -time <seconds> (progressive rendering up to -spp), -snapshot <path> (image after every pass),
+    //-adaptive <error> (adaptive sampling with the budget of -spp), -adaptive-max-spp <samples>, -sample-map <path>,
+    //-roulette <bounces> (Russian roulette after this many bounces, 0 turns it off), -integrator path|wavefront,
+    //-packet 4|8|16 (wavefront integrator with packets of camera and first bounce rays),
+    //-sort-rays <count> (wavefront integrator reordering secondary rays in runs of count)
+    //Alone, -compare <a> <b> prints how far one image is from another instead of rendering, e.g. a RAY_FLOAT
+    //render against the double one of the same options (PPM or PFM, see image_reader.h)
+    if(argc == 4 && std::string(argv[1]) == "-compare")
+        return compare_images(argv[2], argv[3]) ? 0 : 1;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if(arg == "-accel") accel = argv[i + 1];
+        else if(arg == "-width") image_width = std::stoi(argv[i + 1]);
+        else if(arg == "-spp") samples_per_pixel = std::stoi(argv[i + 1]);
+        else if(arg == "-spheres") field = std::max(11, static_cast<int>(std::ceil(std::sqrt(std::stod(argv[i + 1])) / 2)));
+        else if(arg == "-build") build.method = std::string(argv[i + 1]) == "lbvh" ? bvh_build_method::lbvh : bvh_build_method::sah;
+        else if(arg == "-build-threads") build.threads = std::stoi(argv[i + 1]);
+        else if(arg == "-frames") frames = std::stoi(argv[i + 1]);
+        else if(arg == "-motion") motion = argv[i + 1];
+        else if(arg == "-prims") prims = argv[i + 1];
+        else if(arg == "-tile") render.tile_size = std::stoi(argv[i + 1]);
+        else if(arg == "-threads") threads = std::stoi(argv[i + 1]);
+        else if(arg == "-o") output = argv[i + 1];
+        else if(arg == "-band") render.band_rows = std::stoi(argv[i + 1]);
+        else if(arg == "-pass-spp") render.pass_spp = std::stoi(argv[i + 1]);
+        else if(arg == "-time") render.time_budget = std::stod(argv[i + 1]);
+        else if(arg == "-snapshot") snapshot = argv[i + 1];
+        else if(arg == "-adaptive") render.adaptive_error = std::stod(argv[i + 1]);
+        else if(arg == "-adaptive-max-spp") render.adaptive_max_spp = std::stoi(argv[i + 1]);
+        else if(arg == "-sample-map") render.sample_map = argv[i + 1];
+        else if(arg == "-roulette") roulette_depth = std::stoi(argv[i + 1]);
+        else if(arg == "-packet")
+        {
+            int size = std::stoi(argv[i + 1]);
+            render.packet_size = size >= 16 ? 16 : size >= 8 ? 8 : size >= 4 ? 4 : 0;
+            if(render.packet_size > 0) render.integrator = integrator_type::wavefront;
+        }
+        else if(arg == "-sort-rays")
+        {
+            render.sort_buffer = std::stoi(argv[i + 1]);
+            if(render.sort_buffer > 1) render.integrator = integrator_type::wavefront;
+        }
+        else if(arg == "-integrator")
+            render.integrator = std::string(argv[i + 1]) == "wavefront" ? integrator_type::wavefront : integrator_type::path;
+        else if(arg == "-framebuffer-file") render.framebuffer_file = argv[i + 1];
+        else if(arg == "-format")
+        {
+            format_given = parse_image_format(argv[i + 1], render.format);
+            if(!format_given) std::clog << "Unknown format " << argv[i + 1] << "\n";
+        }
+        else if(arg == "-sampler")
+        {
+            std::string name = argv[i + 1];
+            sampling = name == "independent" ? sampler_type::independent
+                     : name == "stratified" ? sampler_type::stratified
+                     : name == "bluenoise" ? sampler_type::blue_noise : sampler_type::sobol;
+        }
+        else std::clog << "Unknown option " << arg << "\n";
+    }
+
+    if(!output.empty() && !format_given)
+        render.format = image_format_from_path(output);
+    if(!snapshot.empty())
+        render.on_pass = [snapshot](const framebuffer& image, int) { write_image(image, snapshot, image_format_from_path(snapshot)); };
+
     hittable_list world;
 
+    struct mover
+    {
+        shared_ptr<sphere> ball; //Null when the sphere lives in field_set
+        int id;
+        point3 rest;
+        double phase;
+    };
+    std::vector<mover> movers;
+    auto field_set = make_shared<sphere_set>();
+
     auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
     world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
 
-    for(int a = -11; a < 11; a++){
-        for(int b = -11; b < 11; b++){
+    for(int a = -field; a < field; a++){
+        for(int b = -field; b < field; b++){
             auto choose_mat = random_double();
             point3 centre(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
 
@@ -40,19 +145,25 @@ int main()
                 if(choose_mat < 0.8){
                     auto albedo = color::random() * color::random();
                     sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
                 }
 
                 else if(choose_mat < 0.95){
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
                     sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
                 }
 
                 else{
                     sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
+                }
+
+                if(prims == "soa"){
+                    movers.push_back(mover{nullptr, field_set->add(centre, 0.2, sphere_material), centre, 0.7*a + 1.3*b});
+                }
+                else{
+                    auto ball = make_shared<sphere>(centre, 0.2, sphere_material);
+                    world.add(ball);
+                    movers.push_back(mover{ball, -1, centre, 0.7*a + 1.3*b});
                 }
             }
         }
@@ -67,12 +178,29 @@ int main()
     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
+    //A flat scan tests the whole set at once, hierarchies get it as small clusters for leaves
+    if(field_set->size() > 0 && accel == "list")
+        world.add(field_set);
+    else if(field_set->size() > 0)
+        for(const auto& cluster : field_set->clusters(8))
+            world.add(cluster);
+
+    shared_ptr<bvh_node> tree;
+    if(accel != "list" && accel != "grid")
+        tree = make_shared<bvh_node>(world, build);
+
+    //Materials are copied into one table; hit records refer to them by index
+    material_table materials;
+    world.bind_materials(materials);
+
     camera cam;
 
     cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1200;
-    cam.samples_per_pixel = 10;
+    cam.image_width = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
     cam.max_depth = 20;
+    cam.roulette_depth = roulette_depth;
+    cam.sampling = sampling;
 
     cam.vfov = 20;
     cam.lookfrom = point3(13,2,3);
@@ -83,5 +211,55 @@ int main()
     cam.focus_dist = 10.0;
 
     cam.initialize();
-    imagerender(cam, world);
+
+    //One pool for every frame, threads are not recreated per render
+    thread_pool pool(threads);
+    render.pool = &pool;
+
+    for(int frame = 0; frame < frames; frame++)
+    {
+        cam.frame = frame;
+        if(frame > 0)
+        {
+            auto time = frame / 24.0;
+            for(auto& m : movers)
+            {
+                auto centre = m.rest + vec3(0, 0.5*fabs(sin(4*time + m.phase)), 0);
+                if(motion == "drift")
+                {
+                    //Circles of a quarter of the field through the rest position, so neighbours scatter apart
+                    auto radius = 0.25*field;
+                    auto angle = 3*time + m.phase;
+                    centre = m.rest + radius*vec3(sin(angle) - sin(m.phase), 0, cos(angle) - cos(m.phase));
+                }
+                if(m.ball)
+                    m.ball->set_centre(centre);
+                else
+                    field_set->set_centre(m.id, centre);
+            }
+            if(tree)
+                tree->update();
+        }
+
+        hittable_list scene = world;
+        if(accel == "bvh")
+            scene = hittable_list(tree);
+        else if(accel == "bvh4")
+            scene = hittable_list(make_shared<bvh_wide<4>>(*tree));
+        else if(accel == "bvh8")
+            scene = hittable_list(make_shared<bvh_wide<8>>(*tree));
+        else if(accel == "grid")
+            scene = hittable_list(make_shared<grid_accel>(world, 2.0, true));
+
+        //Frames of an animation get numbered files
+        render.output = output;
+        if(frames > 1 && !output.empty())
+        {
+            char number[16];
+            std::snprintf(number, sizeof(number), "_%04d", frame);
+            auto dot = output.find_last_of('.');
+            render.output.insert(dot == std::string::npos ? output.size() : dot, number);
+        }
+        imagerender(cam, scene, materials, render);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Read/write memory mapping of a file created for it, so large buffers are paged by the OS instead of held in RAM
+class mapped_file
+{
+    public:
+        mapped_file() = default;
+        ~mapped_file() { close(); }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        //Creates (or truncates) path to size bytes of zeros and maps it; false on failure
+        bool open(const std::string& path, size_t size)
+        {
+            close();
+            if(size == 0) return false;
+#ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file == INVALID_HANDLE_VALUE) return false;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32),
+                                         static_cast<DWORD>(size & 0xffffffffu), nullptr);
+            if(!mapping) { close(); return false; }
+            view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+            if(!view) { close(); return false; }
+#else
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0) return false;
+            if(ftruncate(fd, static_cast<off_t>(size)) != 0) { ::close(fd); return false; }
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd); //The mapping keeps the file open
+            if(p == MAP_FAILED) return false;
+            view = p;
+#endif
+            bytes = size;
+            return true;
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if(view) UnmapViewOfFile(view);
+            if(mapping) CloseHandle(mapping);
+            if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#else
+            if(view) munmap(view, bytes);
+#endif
+            view = nullptr;
+            bytes = 0;
+        }
+
+        void* data() const { return view; }
+        size_t size() const { return bytes; }
+
+    private:
+        void* view = nullptr;
+        size_t bytes = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+};
+
+#endif
@@ -3,83 +3,137 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "sampler.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 
 class hit_record;
 
+//Tagged material record, scattered with a switch instead of a virtual call.
+//lambertian, metal and dielectric only fill in the record, so scenes are built with them as before
+//and material_table copies the records into one contiguous array for rendering.
 class material
 {
     public:
-        virtual ~material() = default;
-
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
-};
+        enum class kind : uint8_t { lambertian, metal, dielectric };
 
-class lambertian : public material
-{
-    private:
-        color albedo;
+        kind type() const { return tag; }
 
-    public:
-        lambertian(const color& a) : albedo(a) {};
+        //Draws one sampler dimension
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const
+        {
+            switch(tag)
+            {
+                case kind::lambertian: return scatter_lambertian(rec, attenuation, scattered, s);
+                case kind::metal: return scatter_metal(r_in, rec, attenuation, scattered, s);
+                case kind::dielectric: return scatter_dielectric(r_in, rec, attenuation, scattered, s);
+            }
+            return false;
+        }
 
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+        //Per kind scatter, for callers that already sorted their hits by type()
+        bool scatter_lambertian(const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const
         {
-            auto scatter_direction = rec.normal + random_unit_vector();
+            auto u = s.get_2d();
+            auto scatter_direction = rec.normal + square_to_unit_vector(u.u, u.v);
             if(scatter_direction.near_zero())
                 scatter_direction = rec.normal;
             scattered = ray(rec.p, scatter_direction);
             attenuation = albedo;
             return true;
         }
-};
-
-class metal : public material
-{
-    private:
-        color albedo;
-        double fuzz;
-    public:
-        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}; 
 
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+        bool scatter_metal(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const
         {
+            auto u = s.get_2d();
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_unit_vector());
+            scattered = ray(rec.p, mul_add(param, square_to_unit_vector(u.u, u.v), reflected));
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
-};
 
-class dielectric : public material 
-{
-    private:
-        double ir;
-        static double reflectance(double cosine, double ref_idx)
-        {
-            auto r0 = (1-ref_idx) / (1+ref_idx);
-            r0 = r0*r0;
-            return r0 + (1-r0)*pow((1-cosine), 5);
-        }
-    public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
-        
-        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+        bool scatter_dielectric(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const
         {
             attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+            double refraction_ratio = rec.front_face ? (1.0/param) : param;
             vec3 unit_direction = unit_vector(r_in.direction());
             double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
             double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
 
             bool cannot_refract = refraction_ratio * sin_theta > 1.0;
             vec3 direction;
-            if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+            if(cannot_refract || reflectance(cos_theta, refraction_ratio) > s.get_1d())
                 direction = reflect(unit_direction, rec.normal);
             else
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
             scattered = ray(rec.p, direction);
             return true;
         }
+
+    protected:
+        material(kind k, const color& a, double p) : albedo(a), param(p), tag(k) {}
+
+    private:
+        color albedo;
+        double param; //Fuzz for metal, index of refraction for dielectric
+        kind tag;
+
+        static double reflectance(double cosine, double ref_idx)
+        {
+            auto r0 = (1-ref_idx) / (1+ref_idx);
+            r0 = r0*r0;
+            return r0 + (1-r0)*pow((1-cosine), 5);
+        }
+};
+
+class lambertian : public material
+{
+    public:
+        lambertian(const color& a) : material(kind::lambertian, a, 0) {}
+};
+
+class metal : public material
+{
+    public:
+        metal(const color& a, double f) : material(kind::metal, a, f < 1 ? f : 1) {}
+};
+
+class dielectric : public material
+{
+    public:
+        dielectric(double index_of_refraction) : material(kind::dielectric, color(1, 1, 1), index_of_refraction) {}
+};
+
+//The front end classes add no data, so copying them into the table as plain materials loses nothing
+static_assert(sizeof(lambertian) == sizeof(material) && sizeof(metal) == sizeof(material)
+              && sizeof(dielectric) == sizeof(material), "material front ends must not add members");
+
+//Scene-wide material array; hit records carry indices into it.
+//Filled by hittable::bind_materials(), which maps every primitive's material to its index.
+class material_table
+{
+    public:
+        //Index of mat in the table, added on first use
+        uint32_t add(const shared_ptr<material>& mat)
+        {
+            auto found = index.find(mat.get());
+            if(found != index.end())
+                return found->second;
+            uint32_t id = static_cast<uint32_t>(records.size());
+            records.push_back(*mat);
+            index.emplace(mat.get(), id);
+            return id;
+        }
+
+        const material& operator[](uint32_t id) const { return records[id]; }
+
+        int size() const { return static_cast<int>(records.size()); }
+
+    private:
+        std::vector<material> records;
+        std::unordered_map<const material*, uint32_t> index;
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,126 @@
+#ifndef OUTPUT_PIPELINE_H
+#define OUTPUT_PIPELINE_H
+
+#include "framebuffer.h"
+#include "image_writer.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Blocking FIFO of at most `capacity` items. pop() returns false once the queue is closed and drained.
+template<typename T>
+class bounded_queue
+{
+    public:
+        explicit bounded_queue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+        void push(T item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this] { return items.size() < capacity; });
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+        }
+
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [this] { return closed || !items.empty(); });
+            if(items.empty())
+                return false;
+            item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            not_empty.notify_all();
+        }
+
+    private:
+        size_t capacity;
+        std::deque<T> items;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+};
+
+//Streams an image to its writer on a dedicated I/O thread while it is still being rendered.
+//A band must lie in consecutive framebuffer slots, so resident rows should be a multiple of band_height.
+//Render workers report bands of rows as they complete, in any order; the I/O thread keeps the
+//out of order ones back and encodes the rest top to bottom, so encoding and disk writes overlap rendering.
+class row_pipeline
+{
+    public:
+        //Band b covers rows [b * band_height, (b + 1) * band_height) of image
+        row_pipeline(const framebuffer& image, image_writer& writer, int band_height, size_t queue_capacity = 64)
+        : image(image), writer(writer), band_height(std::max(1, band_height)),
+          bands((image.height() + this->band_height - 1) / this->band_height),
+          completed(queue_capacity), ready(bands, 0)
+        {
+            io = std::thread([this] { drain(); });
+        }
+
+        ~row_pipeline() { finish(); }
+
+        //The band's pixels must not change after this
+        void band_done(int band) { completed.push(band); }
+
+        //Blocks until the first `rows` rows are encoded, after which their framebuffer slots may be reused
+        void wait_written(int rows)
+        {
+            std::unique_lock<std::mutex> lock(progress_mutex);
+            progress.wait(lock, [&] { return rows_written >= rows; });
+        }
+
+        //Waits until every reported band is written
+        void finish()
+        {
+            if(!io.joinable())
+                return;
+            completed.close();
+            io.join();
+        }
+
+    private:
+        const framebuffer& image;
+        image_writer& writer;
+        int band_height;
+        int bands;
+        bounded_queue<int> completed;
+        std::vector<char> ready; //Only touched by the I/O thread
+        int rows_written = 0;
+        std::mutex progress_mutex;
+        std::condition_variable progress;
+        std::thread io;
+
+        void drain()
+        {
+            int next = 0;
+            int band;
+            while(completed.pop(band))
+            {
+                ready[band] = 1;
+                for(; next < bands && ready[next]; next++)
+                {
+                    int first = next * band_height;
+                    int rows = std::min(band_height, image.height() - first);
+                    writer.write_rows(image.row(first), rows);
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    rows_written = first + rows;
+                    progress.notify_all();
+                }
+            }
+        }
+};
+
+#endif
@@ -17,7 +17,7 @@ class ray
         point3 origin() const { return orig; }
         vec3 direction() const { return dir; }
 
-        point3 at(double t) const { return orig + t*dir;}
+        point3 at(real t) const { return mul_add(t, dir, orig); }
 };
 
 #endif
\ No newline at end of file
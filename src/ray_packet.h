@@ -0,0 +1,257 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.h"
+#include "ray.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+
+//Up to max_size coherent rays stored as structure of arrays and traced through the scene together.
+//The full precision copies feed the primitive tests, so a packet finds exactly the hits its rays find one by one;
+//the single precision copies feed the box tests, four lanes per SSE instruction. Inner tree nodes are
+//tested against the bounds of all lanes at once (interval arithmetic), valid once finish() found them coherent.
+class ray_packet
+{
+    public:
+        static const int max_size = 16;
+
+        int size = 0; //Lanes in the packet, 4, 8 or 16
+        uint32_t lanes = 0; //Bit k is set when lane k holds a ray
+        double tmin = 0;
+        alignas(32) real org[3][max_size];
+        alignas(32) real dir[3][max_size];
+        alignas(32) double tmax[max_size]; //Closest hit so far per lane
+        alignas(16) float forg[3][max_size];
+        alignas(16) float finv[3][max_size];
+        alignas(16) float ftmax[max_size];
+        float org_lo[3], org_hi[3]; //Bounds of the lane origins
+        float inv_lo[3], inv_hi[3]; //Bounds of the inverse directions
+        bool negative[3]; //Direction sign per axis, shared by every lane of a coherent packet
+
+        //Empties the packet; lanes are then filled with set()
+        void reset(int packet_size, double t_min)
+        {
+            size = packet_size;
+            lanes = 0;
+            tmin = t_min;
+            for(int k = 0; k < max_size; k++) //Unused lanes are masked off, but must not hold NaNs for the box test
+            {
+                for(int a = 0; a < 3; a++)
+                    org[a][k] = dir[a][k] = forg[a][k] = finv[a][k] = 0;
+                tmax[k] = -infinity;
+                ftmax[k] = -static_cast<float>(infinity);
+            }
+        }
+
+        void set(int k, const ray& r, double t_max)
+        {
+            for(int a = 0; a < 3; a++)
+            {
+                org[a][k] = r.origin()[a];
+                dir[a][k] = r.direction()[a];
+                forg[a][k] = static_cast<float>(org[a][k]);
+                finv[a][k] = static_cast<float>(1 / dir[a][k]);
+            }
+            tmax[k] = t_max;
+            ftmax[k] = static_cast<float>(t_max);
+            lanes |= 1u << k;
+        }
+
+        ray lane_ray(int k) const
+        {
+            return ray(point3(org[0][k], org[1][k], org[2][k]), vec3(dir[0][k], dir[1][k], dir[2][k]));
+        }
+
+        //Records a closer hit on lane k
+        void shorten(int k, double t)
+        {
+            tmax[k] = t;
+            ftmax[k] = static_cast<float>(t);
+        }
+
+        //Computes the lane bounds after the last set(). Returns whether the packet is worth tracing together:
+        //all rays point into one octant, none along an axis plane, and within about 8 degrees of each other.
+        bool finish()
+        {
+            int first = -1;
+            vec3 axis;
+            for(int k = 0; k < size; k++)
+            {
+                if(!(lanes & (1u << k))) continue;
+                vec3 d(dir[0][k], dir[1][k], dir[2][k]);
+                if(d.x() == 0 || d.y() == 0 || d.z() == 0) return false;
+                int octant = (d.x() < 0) | ((d.y() < 0) << 1) | ((d.z() < 0) << 2);
+                if(first < 0)
+                {
+                    first = octant;
+                    axis = unit_vector(d);
+                    for(int a = 0; a < 3; a++)
+                    {
+                        org_lo[a] = org_hi[a] = forg[a][k];
+                        inv_lo[a] = inv_hi[a] = finv[a][k];
+                        negative[a] = d[a] < 0;
+                    }
+                    continue;
+                }
+                if(octant != first || dot(axis, d) < 0.99 * d.length()) return false;
+                for(int a = 0; a < 3; a++)
+                {
+                    org_lo[a] = std::min(org_lo[a], forg[a][k]);
+                    org_hi[a] = std::max(org_hi[a], forg[a][k]);
+                    inv_lo[a] = std::min(inv_lo[a], finv[a][k]);
+                    inv_hi[a] = std::max(inv_hi[a], finv[a][k]);
+                }
+            }
+            return first >= 0;
+        }
+};
+
+//Lanes among `lanes` whose ray enters the box [lo, hi] before its closest hit so far.
+//nearest is set to the smallest entry distance among them.
+inline uint32_t intersect_box(const ray_packet& p, uint32_t lanes, const float lo[3], const float hi[3], float& nearest)
+{
+    //Widen the far distance by a few ulps to absorb the single precision rounding of the slab distances
+    const float tmin = static_cast<float>(p.tmin);
+    uint32_t mask = 0;
+#if defined(RAY_SSE)
+    const __m128 widen = _mm_set1_ps(1.0000004f);
+    const __m128 inf = _mm_set1_ps(static_cast<float>(infinity));
+    __m128 closest = inf;
+    for(int k = 0; k < p.size; k += 4)
+    {
+        if(!((lanes >> k) & 0xf)) continue;
+        __m128 t0 = _mm_set1_ps(tmin);
+        __m128 t1 = _mm_mul_ps(_mm_load_ps(p.ftmax + k), widen);
+        for(int a = 0; a < 3; a++)
+        {
+            __m128 o = _mm_load_ps(p.forg[a] + k);
+            __m128 inv = _mm_load_ps(p.finv[a] + k);
+            __m128 t_lo = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[a]), o), inv);
+            __m128 t_hi = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[a]), o), inv);
+            t0 = _mm_max_ps(_mm_min_ps(t_lo, t_hi), t0); //Lanes differ in direction sign, so no fixed near plane
+            t1 = _mm_min_ps(_mm_max_ps(t_lo, t_hi), t1);
+        }
+        __m128 entered = _mm_cmple_ps(t0, t1);
+        mask |= static_cast<uint32_t>(_mm_movemask_ps(entered)) << k;
+        closest = _mm_min_ps(closest, _mm_or_ps(_mm_and_ps(entered, t0), _mm_andnot_ps(entered, inf)));
+    }
+    closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+    closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+    nearest = _mm_cvtss_f32(closest);
+#else
+    nearest = static_cast<float>(infinity);
+    for(int k = 0; k < p.size; k++)
+    {
+        if(!(lanes & (1u << k))) continue;
+        float t0 = tmin, t1 = p.ftmax[k] * 1.0000004f;
+        for(int a = 0; a < 3; a++)
+        {
+            float t_lo = (lo[a] - p.forg[a][k]) * p.finv[a][k];
+            float t_hi = (hi[a] - p.forg[a][k]) * p.finv[a][k];
+            float near_t = t_lo < t_hi ? t_lo : t_hi;
+            float far_t = t_lo < t_hi ? t_hi : t_lo;
+            t0 = near_t > t0 ? near_t : t0;
+            t1 = far_t < t1 ? far_t : t1;
+        }
+        if(t0 <= t1)
+        {
+            mask |= 1u << k;
+            nearest = t0 < nearest ? t0 : nearest;
+        }
+    }
+#endif
+    return mask & lanes;
+}
+
+//Lanes per group of the sphere test: one SSE register of real, two doubles or four floats
+const int sphere_lanes = 16 / sizeof(real);
+
+//Tests the sphere against packet lanes k .. k + sphere_lanes - 1, k a multiple of sphere_lanes, with the
+//operations of sphere::intersect in the same order, so each lane finds exactly the root its ray finds alone.
+//Returns the lanes (bit 0 for lane k) with a root in (p.tmin, p.tmax) and stores the nearest such root in roots[k + j].
+inline uint32_t intersect_sphere(const ray_packet& p, int k, const point3& centre, real radius, real* roots)
+{
+#if defined(RAY_SSE) && defined(RAY_FLOAT)
+    const __m128 ocx = _mm_sub_ps(_mm_load_ps(p.org[0] + k), _mm_set1_ps(centre.x()));
+    const __m128 ocy = _mm_sub_ps(_mm_load_ps(p.org[1] + k), _mm_set1_ps(centre.y()));
+    const __m128 ocz = _mm_sub_ps(_mm_load_ps(p.org[2] + k), _mm_set1_ps(centre.z()));
+    const __m128 dx = _mm_load_ps(p.dir[0] + k), dy = _mm_load_ps(p.dir[1] + k), dz = _mm_load_ps(p.dir[2] + k);
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    __m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+    __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+        _mm_set1_ps(radius*radius));
+    __m128 disc = _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(a, c));
+    __m128 real_roots = _mm_cmpge_ps(disc, _mm_setzero_ps());
+    if(!_mm_movemask_ps(real_roots)) return 0;
+
+    __m128 sqrtd = _mm_sqrt_ps(disc);
+    __m128 neg_b = _mm_xor_ps(half_b, _mm_set1_ps(-0.0f));
+    __m128 root_near = _mm_div_ps(_mm_sub_ps(neg_b, sqrtd), a);
+    __m128 root_far = _mm_div_ps(_mm_add_ps(neg_b, sqrtd), a);
+
+    //The range is in double, so the roots are widened for the comparison as they are in the scalar test;
+    //the two double masks are narrowed back to four float lanes
+    const __m128d tmin = _mm_set1_pd(p.tmin);
+    auto inside = [&](__m128 root) {
+        __m128d lo = _mm_cvtps_pd(root), hi = _mm_cvtps_pd(_mm_movehl_ps(root, root));
+        __m128d in_lo = _mm_and_pd(_mm_cmpgt_pd(lo, tmin), _mm_cmplt_pd(lo, _mm_load_pd(p.tmax + k)));
+        __m128d in_hi = _mm_and_pd(_mm_cmpgt_pd(hi, tmin), _mm_cmplt_pd(hi, _mm_load_pd(p.tmax + k + 2)));
+        return _mm_shuffle_ps(_mm_castpd_ps(in_lo), _mm_castpd_ps(in_hi), _MM_SHUFFLE(2, 0, 2, 0));
+    };
+    __m128 near_in = _mm_and_ps(real_roots, inside(root_near));
+    __m128 far_in = _mm_and_ps(real_roots, inside(root_far));
+    _mm_store_ps(roots + k, _mm_or_ps(_mm_and_ps(near_in, root_near), _mm_andnot_ps(near_in, root_far)));
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_or_ps(near_in, far_in)));
+#elif defined(RAY_SSE)
+    const __m128d ocx = _mm_sub_pd(_mm_load_pd(p.org[0] + k), _mm_set1_pd(centre.x()));
+    const __m128d ocy = _mm_sub_pd(_mm_load_pd(p.org[1] + k), _mm_set1_pd(centre.y()));
+    const __m128d ocz = _mm_sub_pd(_mm_load_pd(p.org[2] + k), _mm_set1_pd(centre.z()));
+    const __m128d dx = _mm_load_pd(p.dir[0] + k), dy = _mm_load_pd(p.dir[1] + k), dz = _mm_load_pd(p.dir[2] + k);
+    __m128d a = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+    __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+    __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)),
+        _mm_set1_pd(radius*radius));
+    __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+    __m128d real_roots = _mm_cmpge_pd(disc, _mm_setzero_pd());
+    if(!_mm_movemask_pd(real_roots)) return 0;
+
+    __m128d sqrtd = _mm_sqrt_pd(disc);
+    __m128d neg_b = _mm_xor_pd(half_b, _mm_set1_pd(-0.0));
+    __m128d root_near = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+    __m128d root_far = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+
+    const __m128d tmin = _mm_set1_pd(p.tmin), tmax = _mm_load_pd(p.tmax + k);
+    __m128d near_in = _mm_and_pd(real_roots, _mm_and_pd(_mm_cmpgt_pd(root_near, tmin), _mm_cmplt_pd(root_near, tmax)));
+    __m128d far_in = _mm_and_pd(real_roots, _mm_and_pd(_mm_cmpgt_pd(root_far, tmin), _mm_cmplt_pd(root_far, tmax)));
+    _mm_store_pd(roots + k, _mm_or_pd(_mm_and_pd(near_in, root_near), _mm_andnot_pd(near_in, root_far)));
+    return static_cast<uint32_t>(_mm_movemask_pd(_mm_or_pd(near_in, far_in)));
+#else
+    uint32_t mask = 0;
+    for(int j = 0; j < sphere_lanes; j++)
+    {
+        int lane = k + j;
+        vec3 oc = point3(p.org[0][lane], p.org[1][lane], p.org[2][lane]) - centre;
+        vec3 d(p.dir[0][lane], p.dir[1][lane], p.dir[2][lane]);
+        real a = d.length_squared();
+        real half_b = dot(oc, d);
+        real c = oc.length_squared() - radius*radius;
+        real discriminant = half_b*half_b - a*c;
+        if(discriminant < 0) continue;
+
+        real sqrtd = sqrt(discriminant);
+        real root = (-half_b - sqrtd) / a;
+        if(!(p.tmin < root && root < p.tmax[lane]))
+        {
+            root = (-half_b + sqrtd) / a;
+            if(!(p.tmin < root && root < p.tmax[lane])) continue;
+        }
+        roots[lane] = root;
+        mask |= 1u << j;
+    }
+    return mask;
+#endif
+}
+
+#endif
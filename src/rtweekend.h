@@ -2,8 +2,8 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <memory>
-#include <cstdlib>
 #include <limits>
 
 //Using statements
@@ -11,6 +11,18 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+//Scalar of the vector, ray, sphere and camera math: float when built with RAY_FLOAT, double otherwise.
+//Colours are vectors too, so this also sets the framebuffer precision.
+//ray_tmin skips self-intersections of rays leaving a surface; hit points on the radius 1000 ground
+//are only good to about 1e-4 in single precision, so grazing bounces need the larger offset.
+#ifdef RAY_FLOAT
+using real = float;
+const double ray_tmin = 0.01;
+#else
+using real = double;
+const double ray_tmin = 0.001;
+#endif
+
 //Constants
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -22,9 +34,67 @@ inline double degrees_to_radian(double degrees)
 }
 
 //Random number generation
+
+//PCG32 (XSH-RR variant): 64 bit state, one of 2^63 streams selected by the increment
+class pcg32
+{
+    public:
+        pcg32(uint64_t initstate = 0x853c49e6748fea9bULL, uint64_t initseq = 0xda3e39cb94b95bdbULL)
+        {
+            seed(initstate, initseq);
+        }
+
+        void seed(uint64_t initstate, uint64_t initseq)
+        {
+            state = 0;
+            inc = (initseq << 1) | 1;
+            next();
+            state += initstate;
+            next();
+        }
+
+        uint32_t next()
+        {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            uint32_t rot = static_cast<uint32_t>(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        double next_double() { return next() * (1.0 / 4294967296.0); } //[0,1)
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+inline uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//Each thread draws from its own generator, so no lock is shared between render threads
+inline pcg32& thread_rng()
+{
+    thread_local pcg32 rng;
+    return rng;
+}
+
+//Restarts the calling thread's generator on the stream of one (pixel, sample, frame).
+//Every sample then sees the same numbers whichever thread or tile renders it.
+inline void seed_random(uint64_t pixel, uint64_t sample, uint64_t frame)
+{
+    uint64_t key = splitmix64(splitmix64(splitmix64(frame) ^ pixel) ^ sample);
+    thread_rng().seed(key, splitmix64(key));
+}
+
 inline double random_double()
 {
-    return rand() / (RAND_MAX + 1.0); //Generate random number from [0,1)
+    return thread_rng().next_double(); //Generate random number from [0,1)
 }
 
 inline double random_double(double min, double max)
@@ -0,0 +1,324 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+#include <vector>
+
+enum class sampler_type { independent, stratified, sobol, blue_noise };
+
+class sample_2d
+{
+    public:
+        double u;
+        double v;
+};
+
+//Supplies the random dimensions of one camera sample: pixel jitter, lens, then one per bounce.
+//independent draws from the per-sample PCG stream, stratified jitters a per-pixel permutation of strata,
+//sobol is Owen-scrambled and shuffled per dimension, blue_noise shifts one Sobol sequence per pixel
+//by a blue noise tile so the remaining error is spread as high frequency noise over the image.
+class sampler
+{
+    public:
+        static const int pixel_dimension = 0;
+        static const int lens_dimension = 1;
+        static const int first_bounce_dimension = 2;
+
+        sampler(sampler_type t = sampler_type::sobol, int samples_per_pixel = 1)
+        : type(t), samples(samples_per_pixel > 0 ? samples_per_pixel : 1) {}
+
+        void start_pixel_sample(int i, int j, int sample_index, int frame)
+        {
+            uint64_t pixel = (static_cast<uint64_t>(j) << 32) | static_cast<uint32_t>(i);
+            px = i;
+            py = j;
+            sample = static_cast<uint32_t>(sample_index);
+            dimension = 0;
+            frame_seed = splitmix64(frame);
+            pixel_seed = splitmix64(frame_seed ^ pixel);
+            seed_random(pixel, sample_index, frame);
+        }
+
+        void set_dimension(int d) { dimension = d; }
+
+        double get_1d()
+        {
+            int d = dimension++;
+            uint32_t seed = dimension_seed(d);
+            switch(type)
+            {
+                case sampler_type::independent:
+                    return random_double();
+                case sampler_type::stratified:
+                    return (permute_index(sample % samples, samples, seed) + random_double()) / samples;
+                case sampler_type::sobol:
+                {
+                    uint32_t index = nested_uniform_scramble(sample, seed);
+                    return to_unit(reverse_bits(laine_karras(index, mix32(seed))));
+                }
+                case sampler_type::blue_noise:
+                {
+                    uint32_t shared = hash32(frame_seed + d); //Same for every pixel, the tile varies it
+                    uint32_t index = nested_uniform_scramble(sample, shared);
+                    return wrap(to_unit(reverse_bits(index)) + blue_noise_offset(shared));
+                }
+            }
+            return 0;
+        }
+
+        sample_2d get_2d()
+        {
+            int d = dimension++;
+            uint32_t seed = dimension_seed(d);
+            switch(type)
+            {
+                case sampler_type::independent:
+                {
+                    auto u = random_double();
+                    return sample_2d{u, random_double()};
+                }
+                case sampler_type::stratified:
+                {
+                    int nx = static_cast<int>(sqrt(static_cast<double>(samples)));
+                    int ny = (samples + nx - 1) / nx;
+                    uint32_t cell = permute_index(sample % (nx * ny), nx * ny, seed);
+                    auto u = (cell % nx + random_double()) / nx;
+                    return sample_2d{u, (cell / nx + random_double()) / ny};
+                }
+                case sampler_type::sobol:
+                {
+                    uint32_t index = nested_uniform_scramble(sample, seed);
+                    seed = mix32(seed);
+                    uint32_t x = reverse_bits(laine_karras(index, seed)); //Scrambled reverse_bits(index)
+                    seed = mix32(seed);
+                    uint32_t y = nested_uniform_scramble(sobol_second(index), seed);
+                    return sample_2d{to_unit(x), to_unit(y)};
+                }
+                case sampler_type::blue_noise:
+                {
+                    uint32_t shared = hash32(frame_seed + d); //Same for every pixel, the tile varies it
+                    uint32_t index = nested_uniform_scramble(sample, shared);
+                    auto u = wrap(to_unit(reverse_bits(index)) + blue_noise_offset(shared));
+                    return sample_2d{u, wrap(to_unit(sobol_second(index)) + blue_noise_offset(mix32(shared)))};
+                }
+            }
+            return sample_2d{0, 0};
+        }
+
+    private:
+        sampler_type type;
+        uint32_t samples;
+        int px = 0;
+        int py = 0;
+        uint32_t sample = 0;
+        int dimension = 0;
+        uint64_t frame_seed = 0;
+        uint64_t pixel_seed = 0;
+
+        static const int tile_size = 64; //Blue noise tile, a power of two
+
+        uint32_t dimension_seed(int d) const { return hash32(pixel_seed + static_cast<uint64_t>(d)); }
+
+        static uint32_t hash32(uint64_t x) { return static_cast<uint32_t>(splitmix64(x)); }
+
+        static uint32_t mix32(uint32_t x) //Cheaper rehash of an already mixed seed
+        {
+            x ^= x >> 16;
+            x *= 0x7feb352du;
+            x ^= x >> 15;
+            x *= 0x846ca68bu;
+            return x ^ (x >> 16);
+        }
+
+        static double to_unit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+        static double wrap(double x) { return x >= 1 ? x - 1 : x; }
+
+        static uint32_t reverse_bits(uint32_t x)
+        {
+            x = (x << 16) | (x >> 16);
+            x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+            x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+            x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+            x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+            return x;
+        }
+
+        //Second Sobol dimension; the first is reverse_bits(index).
+        //The generator matrix is linear over GF(2), so it is applied a byte at a time from a table
+        static uint32_t sobol_second(uint32_t index)
+        {
+            static const std::vector<uint32_t> table = []
+            {
+                uint32_t direction[32];
+                direction[0] = 1u << 31;
+                for(int k = 1; k < 32; k++)
+                    direction[k] = direction[k - 1] ^ (direction[k - 1] >> 1);
+
+                std::vector<uint32_t> t(4 * 256, 0);
+                for(int byte = 0; byte < 4; byte++)
+                    for(int value = 0; value < 256; value++)
+                        for(int bit = 0; bit < 8; bit++)
+                            if(value & (1 << bit))
+                                t[byte * 256 + value] ^= direction[byte * 8 + bit];
+                return t;
+            }();
+            return table[index & 0xff] ^ table[256 + ((index >> 8) & 0xff)]
+                 ^ table[512 + ((index >> 16) & 0xff)] ^ table[768 + (index >> 24)];
+        }
+
+        //Owen scrambling by hashing (Laine-Karras permutation on the reversed bits, as in Burley 2020).
+        //Applied to a sample index it shuffles the order of the points while keeping power of two blocks intact
+        static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+        {
+            return reverse_bits(laine_karras(reverse_bits(x), seed));
+        }
+
+        //Each output bit depends only on the same and lower input bits
+        static uint32_t laine_karras(uint32_t x, uint32_t seed)
+        {
+            x += seed;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return x;
+        }
+
+        //Random permutation of [0, length) selected by seed, without storing it (Kensler 2013)
+        static uint32_t permute_index(uint32_t i, uint32_t length, uint32_t seed)
+        {
+            uint32_t w = length - 1;
+            w |= w >> 1;
+            w |= w >> 2;
+            w |= w >> 4;
+            w |= w >> 8;
+            w |= w >> 16;
+            do
+            {
+                i ^= seed;
+                i *= 0xe170893d;
+                i ^= seed >> 16;
+                i ^= (i & w) >> 4;
+                i ^= seed >> 8;
+                i *= 0x0929eb3f;
+                i ^= seed >> 23;
+                i ^= (i & w) >> 1;
+                i *= 1 | seed >> 27;
+                i *= 0x6935fa69;
+                i ^= (i & w) >> 11;
+                i *= 0x74dcb303;
+                i ^= (i & w) >> 2;
+                i *= 0x9e501cc3;
+                i ^= (i & w) >> 2;
+                i *= 0xc860a3df;
+                i &= w;
+                i ^= i >> 5;
+            } while(i >= length);
+            return (i + seed) % length;
+        }
+
+        //Tile value for this pixel, read at a shift chosen per dimension so the dimensions stay uncorrelated
+        double blue_noise_offset(uint32_t shift) const
+        {
+            const auto& tile = blue_noise_tile();
+            int x = (px + static_cast<int>(shift)) & (tile_size - 1);
+            int y = (py + static_cast<int>(shift >> 16)) & (tile_size - 1);
+            return (tile[y * tile_size + x] + 0.5) / (tile_size * tile_size);
+        }
+
+        //Rank of every texel in a void-and-cluster ordering (Ulichney 1993), made once on first use
+        static const std::vector<uint16_t>& blue_noise_tile()
+        {
+            static const std::vector<uint16_t> tile = make_blue_noise_tile();
+            return tile;
+        }
+
+        static std::vector<uint16_t> make_blue_noise_tile()
+        {
+            const int n = tile_size * tile_size;
+            const double sigma = 1.5;
+
+            //Toroidal Gaussian energy contributed by a point at the origin
+            std::vector<double> kernel(n);
+            for(int y = 0; y < tile_size; y++)
+                for(int x = 0; x < tile_size; x++)
+                {
+                    int dx = x < tile_size / 2 ? x : tile_size - x;
+                    int dy = y < tile_size / 2 ? y : tile_size - y;
+                    kernel[y * tile_size + x] = exp(-(dx*dx + dy*dy) / (2 * sigma * sigma));
+                }
+
+            std::vector<double> energy(n, 0);
+            std::vector<char> on(n, 0);
+            auto splat = [&](int p, double sign)
+            {
+                int cx = p % tile_size, cy = p / tile_size;
+                for(int y = 0; y < tile_size; y++)
+                {
+                    const double* row = &kernel[((y - cy) & (tile_size - 1)) * tile_size];
+                    for(int x = 0; x < tile_size; x++)
+                        energy[y * tile_size + x] += sign * row[(x - cx) & (tile_size - 1)];
+                }
+            };
+            auto extreme = [&](bool of_on, bool highest)
+            {
+                int best = -1;
+                for(int p = 0; p < n; p++)
+                {
+                    if(on[p] != of_on) continue;
+                    if(best < 0 || (highest ? energy[p] > energy[best] : energy[p] < energy[best]))
+                        best = p;
+                }
+                return best;
+            };
+
+            //Initial pattern: random points relaxed by moving the tightest cluster into the largest void
+            pcg32 rng(0x5eed);
+            int ones = 0;
+            while(ones < n / 10)
+            {
+                int p = static_cast<int>(rng.next() % n);
+                if(on[p]) continue;
+                on[p] = 1;
+                splat(p, 1);
+                ones++;
+            }
+            while(true)
+            {
+                int cluster = extreme(true, true);
+                on[cluster] = 0;
+                splat(cluster, -1);
+                int gap = extreme(false, false);
+                on[gap] = 1;
+                splat(gap, 1);
+                if(gap == cluster) break;
+            }
+
+            //Ranks below the initial pattern come from removing clusters, the rest from filling voids
+            std::vector<uint16_t> rank(n);
+            auto initial_on = on;
+            auto initial_energy = energy;
+            for(int r = ones - 1; r >= 0; r--)
+            {
+                int cluster = extreme(true, true);
+                on[cluster] = 0;
+                splat(cluster, -1);
+                rank[cluster] = static_cast<uint16_t>(r);
+            }
+            on = initial_on;
+            energy = initial_energy;
+            for(int r = ones; r < n; r++)
+            {
+                int gap = extreme(false, false);
+                on[gap] = 1;
+                splat(gap, 1);
+                rank[gap] = static_cast<uint16_t>(r);
+            }
+            return rank;
+        }
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+//Instruction set detection shared by the vectorized kernels
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAY_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(RAY_SSE) && defined(__AVX2__)
+#define RAY_AVX2 1
+#endif
+
+#if defined(RAY_SSE) && defined(__FMA__)
+#define RAY_FMA 1
+#endif
+
+//Kernels marked RAY_TARGET_AVX2 may use AVX2/FMA even when the build does not enable it globally;
+//call them only when cpu_has_avx2() says so. Setting RAY_NO_AVX2 in the environment makes it say no,
+//so the fallback paths can be exercised on AVX2 hardware.
+#if defined(RAY_SSE)
+#include <cstdlib>
+#endif
+
+#if defined(RAY_SSE) && (defined(__GNUC__) || defined(__clang__))
+#define RAY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define RAY_AVX2_DISPATCH 1
+
+inline bool cpu_has_avx2()
+{
+    static const bool has = [] {
+        if(std::getenv("RAY_NO_AVX2")) return false;
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }();
+    return has;
+}
+#elif defined(RAY_SSE) && defined(_MSC_VER)
+#include <intrin.h>
+#define RAY_TARGET_AVX2
+#define RAY_AVX2_DISPATCH 1
+
+inline bool cpu_has_avx2()
+{
+    static const bool has = [] {
+        if(std::getenv("RAY_NO_AVX2")) return false;
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        if(!osxsave || !fma || (_xgetbv(0) & 6) != 6) return false; //OS must save the YMM registers
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return has;
+}
+#endif
+
+#endif
\ No newline at end of file
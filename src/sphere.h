@@ -3,18 +3,28 @@
 
 #include "vec3.h"
 #include "hittable.h"
+#include "material.h"
 
 class sphere : public hittable
 {
     private:
         point3 centre;
-        double radius;
+        real radius;
         shared_ptr<material> mat;
+        uint32_t mat_id = 0; //Index in the material_table given to bind_materials()
+        aabb bbox;
 
     public:
-        sphere(point3 _centre, double _radius, shared_ptr<material> _mat) : centre(_centre), radius(_radius), mat(_mat) {}
+        sphere(point3 _centre, real _radius, shared_ptr<material> _mat) : centre(_centre), radius(_radius), mat(_mat)
+        {
+            update_bbox();
+        }
+
+        //Moving or resizing a sphere inside an acceleration structure needs a refit of that structure afterwards
+        void set_centre(const point3& c) { centre = c; update_bbox(); }
+        void set_radius(real r) { radius = r; update_bbox(); }
 
-        bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
         {
             vec3 oc = r.origin() - centre;
             auto a = r.direction().length_squared();
@@ -33,15 +43,49 @@ class sphere : public hittable
                 if(!ray_t.surrounds(root)) return false;
             }
 
-            rec.t = root;
+            hit.t = root;
+            hit.object = this;
+            return true;
+        }
+
+        //Same arithmetic as intersect(), sphere_lanes packet lanes per SSE instruction
+        void intersect_packet(ray_packet& p, uint32_t lanes, closest_hit* hits) const override
+        {
+            alignas(16) real roots[ray_packet::max_size];
+            const uint32_t group = (1u << sphere_lanes) - 1;
+            for(int k = 0; k < p.size; k += sphere_lanes)
+            {
+                if(!((lanes >> k) & group)) continue;
+                uint32_t found = intersect_sphere(p, k, centre, radius, roots) & (lanes >> k);
+                for(int j = 0; found; j++, found >>= 1)
+                {
+                    if(!(found & 1)) continue;
+                    hits[k + j].t = roots[k + j];
+                    hits[k + j].object = this;
+                    p.shorten(k + j, roots[k + j]);
+                }
+            }
+        }
+
+        void surface_interaction(const ray& r, const closest_hit& hit, hit_record& rec) const override
+        {
+            rec.t = hit.t;
             rec.p = r.at(rec.t);
             vec3 outward_normal = (rec.p - centre) / radius;
             rec.set_face_normal(r, outward_normal);
-            rec.mat = mat;
-
-            return true;
+            rec.mat = mat_id;
         }
 
+        void bind_materials(material_table& table) override { mat_id = table.add(mat); }
+
+        aabb bounding_box() const override { return bbox; }
+
+    private:
+        void update_bbox()
+        {
+            auto rvec = vec3(radius, radius, radius);
+            bbox = aabb(centre - rvec, centre + rvec);
+        }
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,357 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+//Spheres stored as structure-of-arrays (centres, radii, material ids) in real precision and intersected
+//with AVX2 when the CPU has it, four doubles or, in the RAY_FLOAT build, eight floats at a time; one at a time otherwise.
+//clusters() splits a set into spatially coherent views over the same storage, to be used as BVH leaves.
+class sphere_set : public hittable
+{
+    public:
+        sphere_set() : data(make_shared<storage>()) {}
+
+        //Returns the id used by set_centre()/set_radius(); ids survive clusters()
+        int add(const point3& centre, real radius, shared_ptr<material> mat)
+        {
+            auto& d = *data;
+            int id = d.count++;
+            d.pad();
+            d.cx[id] = centre.x();
+            d.cy[id] = centre.y();
+            d.cz[id] = centre.z();
+            d.radius[id] = radius;
+
+            auto found = d.material_index.find(mat.get());
+            if(found == d.material_index.end())
+            {
+                found = d.material_index.emplace(mat.get(), static_cast<uint32_t>(d.materials.size())).first;
+                d.materials.push_back(mat);
+            }
+            d.mat_id.push_back(found->second);
+            d.slot.push_back(id);
+            return id;
+        }
+
+        void set_centre(int id, const point3& c)
+        {
+            int s = data->slot[id];
+            data->cx[s] = c.x();
+            data->cy[s] = c.y();
+            data->cz[s] = c.z();
+        }
+
+        void set_radius(int id, real r) { data->radius[data->slot[id]] = r; }
+
+        int size() const { return range_end() - first; }
+
+        bool intersect(const ray& r, interval ray_t, closest_hit& hit) const override
+        {
+            int index = -1;
+#if defined(RAY_AVX2_DISPATCH)
+            if(cpu_has_avx2())
+                nearest_avx2(r, ray_t, index);
+            else
+#endif
+                nearest_scalar(r, ray_t, index);
+            if(index < 0) return false;
+
+            hit.t = ray_t.max;
+            hit.object = this;
+            hit.index = index;
+            return true;
+        }
+
+        //Every sphere of the view against sphere_lanes packet lanes at a time; each lane keeps the first nearest
+        //sphere like nearest_scalar(), as the tests in between see its shortened p.tmax
+        void intersect_packet(ray_packet& p, uint32_t lanes, closest_hit* hits) const override
+        {
+            const auto& d = *data;
+            alignas(16) real roots[ray_packet::max_size];
+            const uint32_t group = (1u << sphere_lanes) - 1;
+            for(int k = 0; k < p.size; k += sphere_lanes)
+            {
+                if(!((lanes >> k) & group)) continue;
+                for(int i = first; i < range_end(); i++)
+                {
+                    uint32_t found = intersect_sphere(p, k, point3(d.cx[i], d.cy[i], d.cz[i]), d.radius[i], roots) & (lanes >> k);
+                    for(int j = 0; found; j++, found >>= 1)
+                    {
+                        if(!(found & 1)) continue;
+                        hits[k + j].t = roots[k + j];
+                        hits[k + j].object = this;
+                        hits[k + j].index = i;
+                        p.shorten(k + j, roots[k + j]);
+                    }
+                }
+            }
+        }
+
+        void surface_interaction(const ray& r, const closest_hit& hit, hit_record& rec) const override
+        {
+            const auto& d = *data;
+            int index = hit.index;
+            point3 centre(d.cx[index], d.cy[index], d.cz[index]);
+            rec.t = hit.t;
+            rec.p = r.at(rec.t);
+            vec3 outward_normal = (rec.p - centre) / d.radius[index];
+            rec.set_face_normal(r, outward_normal);
+            rec.mat = d.bound[d.mat_id[index]];
+        }
+
+        //Binds the whole storage, views share it
+        void bind_materials(material_table& table) override
+        {
+            auto& d = *data;
+            d.bound.resize(d.materials.size());
+            for(size_t i = 0; i < d.materials.size(); i++)
+                d.bound[i] = table.add(d.materials[i]);
+        }
+
+        //Computed on demand, so views stay correct after set_centre()/set_radius() on the storage
+        aabb bounding_box() const override
+        {
+            const auto& d = *data;
+            aabb bbox;
+            for(int i = first; i < range_end(); i++)
+            {
+                auto rvec = vec3(d.radius[i], d.radius[i], d.radius[i]);
+                point3 centre(d.cx[i], d.cy[i], d.cz[i]);
+                bbox = aabb(bbox, aabb(centre - rvec, centre + rvec));
+            }
+            return bbox;
+        }
+
+        //Reorders the storage by recursive median splits and returns views of at most leaf_size spheres each
+        std::vector<shared_ptr<hittable>> clusters(int leaf_size = 8)
+        {
+            auto& d = *data;
+            std::vector<int> order(size());
+            std::iota(order.begin(), order.end(), first);
+            std::vector<shared_ptr<hittable>> views;
+            split(order, 0, static_cast<int>(order.size()), leaf_size, views);
+
+            //Move the spheres so every view covers a contiguous slot range
+            storage sorted = d;
+            std::vector<int> id_of(d.count);
+            for(int id = 0; id < d.count; id++)
+                id_of[d.slot[id]] = id;
+            for(int i = 0; i < static_cast<int>(order.size()); i++)
+            {
+                int to = first + i, from = order[i];
+                sorted.cx[to] = d.cx[from];
+                sorted.cy[to] = d.cy[from];
+                sorted.cz[to] = d.cz[from];
+                sorted.radius[to] = d.radius[from];
+                sorted.mat_id[to] = d.mat_id[from];
+                sorted.slot[id_of[from]] = to;
+            }
+            d = std::move(sorted);
+            return views;
+        }
+
+    private:
+        struct storage
+        {
+            int count = 0;
+            std::vector<real> cx, cy, cz, radius; //Padded by lanes - 1 entries so vector loads never run past the end
+            std::vector<uint32_t> mat_id;
+            std::vector<shared_ptr<material>> materials;
+            std::vector<uint32_t> bound; //material_table index of each entry in materials
+            std::unordered_map<const material*, uint32_t> material_index;
+            std::vector<int> slot; //Current position of each sphere id
+
+            static const int lanes = 32 / sizeof(real); //One AVX register
+
+            void pad()
+            {
+                cx.resize(count + lanes - 1);
+                cy.resize(count + lanes - 1);
+                cz.resize(count + lanes - 1);
+                radius.resize(count + lanes - 1);
+            }
+        };
+
+        shared_ptr<storage> data;
+        int first = 0;
+        int last = -1; //One past the last slot of a view, -1 for the whole set
+
+        sphere_set(shared_ptr<storage> d, int begin, int end) : data(d), first(begin), last(end) {}
+
+        int range_end() const { return last < 0 ? data->count : last; }
+
+        void split(std::vector<int>& order, int begin, int end, int leaf_size, std::vector<shared_ptr<hittable>>& views) const
+        {
+            const auto& d = *data;
+            if(end - begin <= leaf_size)
+            {
+                views.push_back(shared_ptr<sphere_set>(new sphere_set(data, first + begin, first + end)));
+                return;
+            }
+
+            aabb bounds;
+            for(int i = begin; i < end; i++)
+            {
+                point3 c(d.cx[order[i]], d.cy[order[i]], d.cz[order[i]]);
+                bounds = aabb(bounds, aabb(c, c));
+            }
+            const auto& coord = bounds.longest_axis() == 0 ? d.cx : bounds.longest_axis() == 1 ? d.cy : d.cz;
+            int mid = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                [&coord](int a, int b) { return coord[a] < coord[b]; });
+            split(order, begin, mid, leaf_size, views);
+            split(order, mid, end, leaf_size, views);
+        }
+
+        //Closest root in ray_t over the view; shrinks ray_t.max to it and returns its slot in index
+        void nearest_scalar(const ray& r, interval& ray_t, int& index) const
+        {
+            const auto& d = *data;
+            vec3 dir = r.direction();
+            point3 orig = r.origin();
+            auto a = dir.length_squared();
+            for(int i = first; i < range_end(); i++)
+            {
+                vec3 oc = orig - point3(d.cx[i], d.cy[i], d.cz[i]);
+                auto half_b = dot(oc, dir);
+                auto c = oc.length_squared() - d.radius[i]*d.radius[i];
+                auto discriminant = half_b*half_b - a*c;
+                if(discriminant < 0) continue;
+
+                auto sqrtd = sqrt(discriminant);
+                auto root = (-half_b - sqrtd) / a;
+                if(!ray_t.surrounds(root))
+                {
+                    root = (-half_b + sqrtd) / a;
+                    if(!ray_t.surrounds(root)) continue;
+                }
+                ray_t.max = root;
+                index = i;
+            }
+        }
+
+#if defined(RAY_AVX2_DISPATCH) && defined(RAY_FLOAT)
+        RAY_TARGET_AVX2 void nearest_avx2(const ray& r, interval& ray_t, int& index) const
+        {
+            const auto& d = *data;
+            vec3 dir = r.direction();
+            point3 orig = r.origin();
+            const __m256 ox = _mm256_set1_ps(orig.x()), oy = _mm256_set1_ps(orig.y()), oz = _mm256_set1_ps(orig.z());
+            const __m256 dx = _mm256_set1_ps(dir.x()), dy = _mm256_set1_ps(dir.y()), dz = _mm256_set1_ps(dir.z());
+            const __m256 a = _mm256_set1_ps(dir.length_squared());
+            const __m256 tmin = _mm256_set1_ps(static_cast<float>(ray_t.min));
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256i end = _mm256_set1_epi32(range_end());
+            __m256 best_t = _mm256_set1_ps(static_cast<float>(ray_t.max));
+            __m256i best_i = _mm256_set1_epi32(-1);
+            __m256i lane = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+            for(int i = first; i < range_end(); i += 8)
+            {
+                __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&d.cx[i]));
+                __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&d.cy[i]));
+                __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&d.cz[i]));
+                __m256 rad = _mm256_loadu_ps(&d.radius[i]);
+
+                __m256 half_b = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+                __m256 c = _mm256_fmsub_ps(ocz, ocz, _mm256_fmsub_ps(rad, rad, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))));
+                __m256 disc = _mm256_fmsub_ps(half_b, half_b, _mm256_mul_ps(a, c));
+                __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+
+                //Near root when it lies past tmin, the far root otherwise, like sphere::hit
+                __m256 neg_b = _mm256_sub_ps(zero, half_b);
+                __m256 root_near = _mm256_div_ps(_mm256_sub_ps(neg_b, sqrtd), a);
+                __m256 root_far = _mm256_div_ps(_mm256_add_ps(neg_b, sqrtd), a);
+                __m256 use_near = _mm256_cmp_ps(root_near, tmin, _CMP_GT_OQ);
+                __m256 root = _mm256_blendv_ps(root_far, root_near, use_near);
+
+                __m256 in_view = _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, lane));
+                __m256 valid = _mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GE_OQ), in_view);
+                __m256 closer = _mm256_and_ps(_mm256_cmp_ps(root, tmin, _CMP_GT_OQ), _mm256_cmp_ps(root, best_t, _CMP_LT_OQ));
+                __m256 take = _mm256_and_ps(valid, closer);
+                best_t = _mm256_blendv_ps(best_t, root, take);
+                best_i = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_i), _mm256_castsi256_ps(lane), take));
+                lane = _mm256_add_epi32(lane, _mm256_set1_epi32(8));
+            }
+
+            alignas(32) float t[8];
+            alignas(32) int id[8];
+            _mm256_store_ps(t, best_t);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(id), best_i);
+            for(int k = 0; k < 8; k++)
+            {
+                if(id[k] >= 0 && (t[k] < ray_t.max || (t[k] == ray_t.max && id[k] < index)))
+                {
+                    ray_t.max = t[k];
+                    index = id[k];
+                }
+            }
+        }
+#elif defined(RAY_AVX2_DISPATCH)
+        RAY_TARGET_AVX2 void nearest_avx2(const ray& r, interval& ray_t, int& index) const
+        {
+            const auto& d = *data;
+            vec3 dir = r.direction();
+            point3 orig = r.origin();
+            const __m256d ox = _mm256_set1_pd(orig.x()), oy = _mm256_set1_pd(orig.y()), oz = _mm256_set1_pd(orig.z());
+            const __m256d dx = _mm256_set1_pd(dir.x()), dy = _mm256_set1_pd(dir.y()), dz = _mm256_set1_pd(dir.z());
+            const __m256d a = _mm256_set1_pd(dir.length_squared());
+            const __m256d tmin = _mm256_set1_pd(ray_t.min);
+            const __m256d zero = _mm256_setzero_pd();
+            const __m256d end = _mm256_set1_pd(range_end());
+            __m256d best_t = _mm256_set1_pd(ray_t.max);
+            __m256d best_i = _mm256_set1_pd(-1);
+            __m256d lane = _mm256_add_pd(_mm256_set1_pd(first), _mm256_set_pd(3, 2, 1, 0));
+
+            for(int i = first; i < range_end(); i += 4)
+            {
+                __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&d.cx[i]));
+                __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&d.cy[i]));
+                __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&d.cz[i]));
+                __m256d rad = _mm256_loadu_pd(&d.radius[i]);
+
+                __m256d half_b = _mm256_fmadd_pd(ocz, dz, _mm256_fmadd_pd(ocy, dy, _mm256_mul_pd(ocx, dx)));
+                __m256d c = _mm256_fmsub_pd(ocz, ocz, _mm256_fmsub_pd(rad, rad, _mm256_fmadd_pd(ocy, ocy, _mm256_mul_pd(ocx, ocx))));
+                __m256d disc = _mm256_fmsub_pd(half_b, half_b, _mm256_mul_pd(a, c));
+                __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+
+                //Near root when it lies past tmin, the far root otherwise, like sphere::hit
+                __m256d neg_b = _mm256_sub_pd(zero, half_b);
+                __m256d root_near = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+                __m256d root_far = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+                __m256d use_near = _mm256_cmp_pd(root_near, tmin, _CMP_GT_OQ);
+                __m256d root = _mm256_blendv_pd(root_far, root_near, use_near);
+
+                __m256d valid = _mm256_and_pd(_mm256_cmp_pd(disc, zero, _CMP_GE_OQ), _mm256_cmp_pd(lane, end, _CMP_LT_OQ));
+                __m256d closer = _mm256_and_pd(_mm256_cmp_pd(root, tmin, _CMP_GT_OQ), _mm256_cmp_pd(root, best_t, _CMP_LT_OQ));
+                __m256d take = _mm256_and_pd(valid, closer);
+                best_t = _mm256_blendv_pd(best_t, root, take);
+                best_i = _mm256_blendv_pd(best_i, lane, take);
+                lane = _mm256_add_pd(lane, _mm256_set1_pd(4));
+            }
+
+            alignas(32) double t[4], id[4];
+            _mm256_store_pd(t, best_t);
+            _mm256_store_pd(id, best_i);
+            for(int k = 0; k < 4; k++)
+            {
+                if(id[k] >= 0 && (t[k] < ray_t.max || (t[k] == ray_t.max && static_cast<int>(id[k]) < index)))
+                {
+                    ray_t.max = t[k];
+                    index = static_cast<int>(id[k]);
+                }
+            }
+        }
+#endif
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Long-lived worker threads running submitted tasks in order.
+//Threads are created once, so back to back renders (frames, batches) only pay for queueing their work.
+//Tasks must not wait on other tasks of the same pool.
+class thread_pool
+{
+    public:
+        //0 threads uses every hardware thread
+        explicit thread_pool(int threads = 0)
+        {
+            if(threads <= 0)
+                threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            for(int i = 0; i < threads; i++)
+                workers.emplace_back([this] { work(); });
+        }
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            task_ready.notify_all();
+            for(auto& t : workers)
+                t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        int size() const { return static_cast<int>(workers.size()); }
+
+        //The future becomes ready when the task has run, and rethrows what it threw
+        std::future<void> submit(std::function<void()> task)
+        {
+            auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+            auto done = packaged->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.emplace_back([packaged] { (*packaged)(); });
+            }
+            task_ready.notify_one();
+            return done;
+        }
+
+        //Blocks until every task submitted so far has finished
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            all_idle.wait(lock, [this] { return tasks.empty() && busy == 0; });
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable task_ready;
+        std::condition_variable all_idle;
+        int busy = 0;
+        bool stopping = false;
+
+        void work()
+        {
+            while(true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    task_ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if(tasks.empty())
+                        return; //Stopping with nothing left to run
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                    busy++;
+                }
+                task();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy--;
+                    if(tasks.empty() && busy == 0)
+                        all_idle.notify_all();
+                }
+            }
+        }
+};
+
+//Process-wide pool with one thread per hardware thread, created on first use
+inline thread_pool& shared_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+#endif
@@ -6,6 +6,12 @@
 #include "sphere.h"
 #include "material.h"
 #include "sphere.h"
+#include "tile_scheduler.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "output_pipeline.h"
+#include "mapped_file.h"
+#include "wavefront.h"
 
 #include <cstring>
 #include <string>
@@ -21,152 +27,232 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
-#include <queue>
+#include <algorithm>
+#include <functional>
 
-std::mutex writeM;
+enum class integrator_type { path, wavefront };
 
-struct BlockJob {
-    int row_start = 0;
-    int row_end = 0;
-    int col_size;
-    std::vector<int> indices;
-    std::vector<vec3> colors;
+struct render_settings {
+    integrator_type integrator = integrator_type::path; // Full renders only, progressive passes trace depth first
+    int packet_size = 0; // Wavefront only: 4, 8 or 16 to intersect camera rays and the first bounce in packets
+    int sort_buffer = 0; // Wavefront only: reorder secondary rays in runs of this many by octant and origin
+    int tile_size = 16; // Square tiles, the unit of work stealing
+    thread_pool* pool = nullptr; // Workers to render on, shared_pool() when null
+    std::string output; // Image path, empty writes to stdout
+    image_format format = image_format::p3; // Stdout keeps the ASCII P3 of the original renderer, -o picks from the extension
+    int band_rows = 0; // Streaming: render this many rows at a time and keep two bands resident, 0 keeps the whole image
+    std::string framebuffer_file; // Memory-map the framebuffer from this file instead of holding it in RAM
+
+    // Progressive mode, used when either is set: passes of pass_spp samples per pixel until
+    // cam.samples_per_pixel or the time budget is reached, whichever comes first
+    int pass_spp = 0;
+    double time_budget = 0; // Seconds; a pass that would not finish in time, judged from the last one, is not started
+    std::function<void(const framebuffer&, int)> on_pass; // Snapshot hook, gets the image and the samples per pixel so far
+
+    // Adaptive sampling, progressive with the same total as cam.samples_per_pixel uniform samples: a pixel stops
+    // once the standard error of its mean drops below adaptive_error (display units, 0.004 is about one 8-bit
+    // level) and the samples it leaves go to noisier pixels, up to adaptive_max_spp each (0: 4x the spp)
+    double adaptive_error = 0;
+    int adaptive_max_spp = 0;
+    std::string sample_map; // Image of red: samples / max spp, green: error / adaptive_error, written after an adaptive render
 };
 
-void render(camera cam, BlockJob job, const hittable& world, std::vector<BlockJob>& imageblocks, std::mutex& mutex,
-std::condition_variable& cv)
+// Sum of samples [first, last) of pixel (i, j); the rays traced are added to segments
+color render_samples(const camera& cam, int i, int j, int first, int last, sampler& s,
+const hittable& world, const material_table& materials, long long& segments)
+{
+    color pixel_color(0,0,0);
+    for(int sample=first; sample < last; ++sample)
+    {
+        s.start_pixel_sample(i, j, sample, cam.frame);
+        ray r = cam.get_ray(i, j, s);
+        pixel_color += cam.ray_color(r, world, materials, s, &segments);
+    }
+    return pixel_color;
+}
+
+// Returns the number of rays traced
+long long render(const camera& cam, const tile& t, const hittable& world, const material_table& materials, framebuffer& image)
 {
-    for(int j=job.row_start; j<job.row_end; ++j)
+    sampler s(cam.sampling, cam.samples_per_pixel);
+    long long segments = 0;
+    for(int j=t.y0; j<t.y1; ++j)
     {
-        for(int i=0; i<job.col_size; ++i)
+        for(int i=t.x0; i<t.x1; ++i)
         {
-            color pixel_color(0,0,0);
-            for(int sample=0; sample < cam.samples_per_pixel; ++sample)
-            {
-                ray r = cam.get_ray(i, j);
-                pixel_color += cam.ray_color(r, cam.max_depth, world);
-            }
+            color pixel_color = render_samples(cam, i, j, 0, cam.samples_per_pixel, s, world, materials, segments);
             pixel_color /= float(cam.samples_per_pixel);
-            pixel_color = vec3(sqrt(pixel_color[0]), sqrt(pixel_color[1]), sqrt(pixel_color[2]));
-            static const interval intensity(0.000, 0.999);
-            pixel_color = vec3(intensity.clamp(pixel_color[0]), intensity.clamp(pixel_color[1]),
-            intensity.clamp(pixel_color[2]));
-
-            const unsigned int index = j * job.col_size + i;
-            job.indices.push_back(index);
-            job.colors.push_back(pixel_color);
+            image.at(i, j) = pixel_color; // Tiles are disjoint, no lock needed
         }
     }
-    std::lock_guard<std::mutex> lock(mutex);
-    imageblocks.push_back(job);
+    return segments;
 }
 
-void ThreadJobLoop(
-	camera cam,const hittable& world,
-	std::queue<BlockJob>& jobQ, 
-	std::vector<BlockJob>& finishedJobs, 
-	std::mutex& mutex,
-	std::condition_variable& cv
-	)
+// Writes the sample count and error of every pixel of an adaptive render as an image
+void write_sample_map(const accumulation_buffer& accumulation, int width, int height, int max_spp,
+double max_error, const std::string& path)
 {
-	std::atomic<bool> hasWork{ true };
-	while (hasWork)
-	{
-		BlockJob job;
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			if (!jobQ.empty())
-			{
-				job = jobQ.front();
-				jobQ.pop();
-			}
-		}
-		// quick/dirty way to find if a job is valid
-		if (job.row_start < job.row_end)
-		{
-			render(cam, job, world, finishedJobs,  mutex, cv);
-		}
-		else
-		{
-			hasWork = false;
-		}
-	}
-
-	// no more jobs.
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		cv.notify_one();
-	}
+    framebuffer map(width, height);
+    for (int j = 0; j < height; ++j)
+        for (int i = 0; i < width; ++i)
+            map.at(i, j) = color(double(accumulation.samples(i, j)) / max_spp,
+                std::fmin(accumulation.error(i, j) / max_error, 1.0), 0);
+    write_image(map, path, image_format_from_path(path));
 }
 
-void imagerender(const camera& cam, const hittable& world) {
-    int size = cam.pixelcount;
-    vec3* image = new vec3[size];
-    memset(&image[0], 0, size * sizeof(vec3));
+// Renders in passes into an accumulation buffer; the framebuffer holds the running mean after each pass
+void progressive_render(const camera& cam, const hittable& world, const material_table& materials,
+const render_settings& settings, thread_pool& pool, framebuffer& image)
+{
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    const bool timed = settings.time_budget > 0;
+    const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(settings.time_budget));
+    const bool adaptive = settings.adaptive_error > 0;
+    const int pass_spp = settings.pass_spp > 0 ? settings.pass_spp : (adaptive ? 4 : 1);
+    const int max_spp = !adaptive ? cam.samples_per_pixel
+        : settings.adaptive_max_spp > 0 ? settings.adaptive_max_spp : 4 * cam.samples_per_pixel;
+    // Fewer samples give too rough a variance estimate to stop on
+    const int min_spp = std::max(pass_spp, std::min(16, cam.samples_per_pixel / 2));
+    const long long pixels = static_cast<long long>(image.width()) * image.height();
+    const long long budget = pixels * cam.samples_per_pixel;
 
-    auto fulltime = std::chrono::high_resolution_clock::now();
-    const int nThreads = std::thread::hardware_concurrency();
-    int nRowsPerJob = 200;
-    int nJobs = cam.image_height / nRowsPerJob; // 1 row per job
-    int leftOver = cam.image_height % nThreads;
-
-    std::mutex mutex;
-    std::condition_variable cvres;
-    std::vector<BlockJob> imageblocks;
-    std::queue<BlockJob> jobqueue;
-    std::vector<std::thread> threads;
-
-    for (int i = 0; i < nJobs; ++i) {
-        BlockJob job;
-        job.row_start = i * nRowsPerJob;
-        job.row_end = job.row_start + nRowsPerJob;
-        if (i == nThreads - 1)
-        {
-            job.row_end = job.row_start + nRowsPerJob + leftOver;
-        }
-        job.col_size = cam.image_width;
+    accumulation_buffer accumulation(image.width(), image.height(), adaptive);
+    std::vector<tile> tiles = make_tiles(image.width(), image.height(), settings.tile_size);
+    std::vector<char> converged(adaptive ? pixels : 0, 0); // Each pixel is only touched by its tile's worker
+    std::atomic<long long> total(0);
+    std::atomic<long long> active(pixels);
+    std::atomic<long long> segments(0);
+    int spp = 0; // Samples of the most sampled pixels
+    int passes = 0;
+    double seconds_per_sample = 0; // Measured on the previous pass, to judge whether the next one fits the time budget
+    // Budgets are settled per pass before it starts, and passes always run to the end, so the image only
+    // depends on how many passes ran. Every active pixel takes every sample of a pass, which fixes its cost.
+    while (spp < max_spp && active > 0) {
+        const int first = spp;
+        const long long affordable = (budget - total) / active;
+        const int last = static_cast<int>(std::min<long long>({first + pass_spp, max_spp, first + affordable}));
+        if (last <= first)
+            break;
+        const long long pass_samples = active * (last - first);
+        const auto pass_start = clock::now();
+        // The first pass always runs so there is an image
+        if (timed && passes > 0 && pass_start + std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(seconds_per_sample * pass_samples)) > deadline)
+            break;
+        run_work_stealing(pool, static_cast<int>(tiles.size()), [&](int index, int) {
+            const tile& t = tiles[index];
+            sampler s(cam.sampling, max_spp);
+            long long samples = 0;
+            long long stopped = 0;
+            long long rays = 0;
+            for (int j = t.y0; j < t.y1; ++j)
+                for (int i = t.x0; i < t.x1; ++i) {
+                    if (!adaptive) {
+                        accumulation.add(i, j, render_samples(cam, i, j, first, last, s, world, materials, rays), last - first);
+                        image.at(i, j) = accumulation.mean(i, j);
+                        samples += last - first;
+                        continue;
+                    }
+                    // Single samples, so the buffer sees each one for the variance
+                    const size_t p = static_cast<size_t>(j) * image.width() + i;
+                    if (converged[p])
+                        continue;
+                    for (int sample = first; sample < last; ++sample)
+                        accumulation.add_sample(i, j, render_samples(cam, i, j, sample, sample + 1, s, world, materials, rays));
+                    image.at(i, j) = accumulation.mean(i, j);
+                    samples += last - first;
+                    if (last >= max_spp || (last >= min_spp && accumulation.error(i, j) <= settings.adaptive_error)) {
+                        converged[p] = 1;
+                        stopped++;
+                    }
+                }
+            total += samples;
+            active -= stopped;
+            segments += rays;
+        });
+        seconds_per_sample = std::chrono::duration<double>(clock::now() - pass_start).count() / pass_samples;
+        spp = last;
+        passes++;
+        if (settings.on_pass)
+            settings.on_pass(image, spp);
+    }
 
-        jobqueue.push(job);
+    std::clog << "Progressive: " << passes << " passes, up to " << spp << " spp in "
+        << std::chrono::duration<double, std::milli>(clock::now() - start).count() << " ms, mean path length "
+        << (total > 0 ? double(segments) / total : 0.0) << " rays\n";
+    if (adaptive) {
+        std::clog << "Adaptive: " << total << " samples, " << double(total) / pixels << " spp on average, "
+            << 100.0 * (pixels - active) / pixels << "% of pixels converged\n";
+        if (!settings.sample_map.empty())
+            write_sample_map(accumulation, image.width(), image.height(), max_spp, settings.adaptive_error, settings.sample_map);
     }
+}
 
-    for (int i = 0; i < nThreads - 1; ++i) {
-        std::thread t([&]() {
-            ThreadJobLoop(cam, world, jobqueue, imageblocks, mutex, cvres);
-        });
-        threads.push_back(std::move(t));
+void imagerender(const camera& cam, const hittable& world, const material_table& materials,
+const render_settings& settings = render_settings()) {
+    if (settings.pass_spp > 0 || settings.time_budget > 0 || settings.adaptive_error > 0) {
+        framebuffer image(cam.image_width, cam.image_height, 0, settings.framebuffer_file);
+        progressive_render(cam, world, materials, settings, settings.pool ? *settings.pool : shared_pool(), image);
+        write_image(image, settings.output, settings.format);
+        return;
     }
 
-    ThreadJobLoop(cam, world, jobqueue, imageblocks, mutex, cvres);
-    std::unique_lock<std::mutex> lock(mutex);
-    cvres.wait(lock, [&imageblocks, &nJobs] {
-        return imageblocks.size() == nJobs;});
+    // Bands are whole rows of tiles; two of them stay resident so one renders while the other is written out
+    const int tile_size = std::max(1, settings.tile_size);
+    int band = cam.image_height;
+    if (settings.band_rows > 0 && settings.band_rows < cam.image_height)
+        band = (settings.band_rows + tile_size - 1) / tile_size * tile_size;
+    framebuffer image(cam.image_width, cam.image_height, band < cam.image_height ? 2 * band : 0,
+        settings.framebuffer_file);
 
-    for (std::thread& t : threads) {
-        t.join();
+    image_output output(settings.output);
+    if (!output)
+        return;
+    // PFM is stored bottom to top; without seeking the writer would hold every band until the end
+    if (settings.format == image_format::pfm && band < cam.image_height && output.get().tellp() == std::streampos(-1)) {
+        std::clog << "-format pfm cannot stream -band output to a pipe, it is stored bottom to top; write it with -o <file>\n";
+        return;
     }
+    auto writer = make_image_writer(settings.format, output.get(), image.width(), image.height());
 
-    for (BlockJob job : imageblocks) {
-        int colorIndex = 0;
-        for (vec3& col : job.colors)
-        {
-            int colIndex = job.indices[colorIndex];
-            image[colIndex] = col;
-            ++colorIndex;
-        }
-    }
+    auto fulltime = std::chrono::high_resolution_clock::now();
+    thread_pool& pool = settings.pool ? *settings.pool : shared_pool();
 
-    std::cout<< "P3\n" << cam.image_width << " " << cam.image_height << "\n255\n";
+    // A row of tiles is done when its counter reaches zero
+    const int tilesPerRow = (cam.image_width + tile_size - 1) / tile_size;
+    std::vector<std::atomic<int>> remaining((cam.image_height + tile_size - 1) / tile_size);
+    for (auto& r : remaining)
+        r = tilesPerRow;
 
-    for (unsigned int i = 0; i < cam.image_width * cam.image_height; ++i)
-    {
-        // BGR to RGB
-        // 2 = r;
-        // 1 = g;
-        // 0 = b;
-        // static const interval intensity(0.000, 0.999);
-        std::cout << static_cast<int>(255.99f * (image[i].e[0])) << " "
-            << static_cast<int>(255.99f * (image[i].e[1])) << " "
-            << static_cast<int>(255.99f * (image[i].e[2])) << "\n";
+    size_t tileCount = 0;
+    std::atomic<long long> segments(0);
+    row_pipeline pipeline(image, *writer, tile_size);
+    for (int first = 0; first < cam.image_height; first += band) {
+        // The band two back shares our slots; a fully resident image shares none
+        if (image.resident_rows() < image.height())
+            pipeline.wait_written(first - image.resident_rows() + band);
+
+        std::vector<tile> tiles = make_tiles(cam.image_width, std::min(first + band, cam.image_height), tile_size, first);
+        tileCount += tiles.size();
+        run_work_stealing(pool, static_cast<int>(tiles.size()), [&](int index, int) {
+            segments += settings.integrator == integrator_type::wavefront
+                ? render_wavefront(cam, tiles[index], world, materials, image, settings.packet_size, settings.sort_buffer)
+                : render(cam, tiles[index], world, materials, image);
+            int tileRow = tiles[index].y0 / tile_size;
+            if (remaining[tileRow].fetch_sub(1) == 1)
+                pipeline.band_done(tileRow);
+        });
     }
+
+    auto render_done = std::chrono::high_resolution_clock::now();
+    pipeline.finish();
+    writer->finish();
+
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    std::clog << "Render: " << ms(fulltime, render_done) << " ms, " << tileCount << " tiles on " << pool.size()
+        << " threads, output done " << ms(render_done, std::chrono::high_resolution_clock::now()) << " ms after the last tile\n";
+    std::clog << "Paths: mean length " << double(segments) / (double(cam.image_width) * cam.image_height * cam.samples_per_pixel)
+        << " rays\n";
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
+
+class tile
+{
+    public:
+        int x0, y0; //First pixel
+        int x1, y1; //One past the last pixel
+};
+
+//Square tiles covering rows [first_row, height) of the image, the last row and column clipped to it
+inline std::vector<tile> make_tiles(int width, int height, int tile_size, int first_row = 0)
+{
+    tile_size = std::max(1, tile_size);
+    std::vector<tile> tiles;
+    for(int y = first_row; y < height; y += tile_size)
+        for(int x = 0; x < width; x += tile_size)
+            tiles.push_back(tile{x, y, std::min(x + tile_size, width), std::min(y + tile_size, height)});
+    return tiles;
+}
+
+//Chase-Lev work stealing deque (with the memory orders of Le et al. 2013) over item indices.
+//The owner pushes and pops at the bottom, other threads steal from the top.
+//The capacity is fixed and must cover every push, so slots are never reused while a thief may read them.
+class ws_deque
+{
+    public:
+        enum class steal_result { success, empty, lost_race };
+
+        explicit ws_deque(int capacity) : items(new std::atomic<int>[std::max(1, capacity)]), capacity(std::max(1, capacity)) {}
+
+        void push(int item)
+        {
+            long b = bottom.load(std::memory_order_relaxed);
+            items[b % capacity].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        bool pop(int& item)
+        {
+            long b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = top.load(std::memory_order_relaxed);
+            if(t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            item = items[b % capacity].load(std::memory_order_relaxed);
+            if(t == b) //Last item, race the thieves for it
+            {
+                bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        steal_result steal(int& item)
+        {
+            long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long b = bottom.load(std::memory_order_acquire);
+            if(t >= b)
+                return steal_result::empty;
+
+            item = items[t % capacity].load(std::memory_order_relaxed);
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return steal_result::lost_race;
+            return steal_result::success;
+        }
+
+    private:
+        alignas(64) std::atomic<long> top{0};
+        alignas(64) std::atomic<long> bottom{0};
+        std::unique_ptr<std::atomic<int>[]> items;
+        long capacity;
+};
+
+//Runs work(index, worker) for every index in [0, count) on the threads of pool and returns when all are done.
+//Indices are dealt round robin and each worker runs its own in increasing order, so the work sweeps through
+//the indices roughly in order (images fill top to bottom). Workers that run dry steal from the far end
+//of the others' deques, so a few expensive items cannot leave the other cores idle.
+//Must not be called from a task of the same pool.
+template<typename Work>
+void run_work_stealing(thread_pool& pool, int count, Work&& work)
+{
+    if(count <= 0) return;
+    int threads = std::min(pool.size(), count);
+    std::vector<std::unique_ptr<ws_deque>> deques;
+    for(int w = 0; w < threads; w++)
+    {
+        int share = (count - w + threads - 1) / threads;
+        deques.push_back(std::make_unique<ws_deque>(share));
+        for(int k = share - 1; k >= 0; k--) //Pushed in reverse so the owner pops them in order
+            deques[w]->push(w + k * threads);
+    }
+
+    auto worker = [&](int w)
+    {
+        int item;
+        while(true)
+        {
+            if(deques[w]->pop(item))
+            {
+                work(item, w);
+                continue;
+            }
+
+            //Own deque is empty; nothing is pushed after the start, so all deques empty means done
+            bool contended = false;
+            bool stolen = false;
+            for(int k = 1; k < threads && !stolen; k++)
+            {
+                auto result = deques[(w + k) % threads]->steal(item);
+                stolen = result == ws_deque::steal_result::success;
+                contended |= result == ws_deque::steal_result::lost_race;
+            }
+            if(stolen)
+                work(item, w);
+            else if(!contended)
+                return;
+        }
+    };
+
+    std::vector<std::future<void>> done;
+    for(int w = 0; w < threads; w++)
+        done.push_back(pool.submit([&worker, w] { worker(w); }));
+    //Every worker reads the locals above, so all of them finish before the first exception is rethrown
+    for(auto& d : done)
+        d.wait();
+    for(auto& d : done)
+        d.get();
+}
+
+#endif
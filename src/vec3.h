@@ -8,18 +8,18 @@
 class vec3
 {
     public:
-        double e[3];
+        real e[3];
 
         vec3():e{0,0,0} {}
-        vec3(double e0, double e1, double e2):e{e0, e1, e2} {}
+        vec3(real e0, real e1, real e2):e{e0, e1, e2} {}
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
 
         vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[] (int i) const { return e[i]; }
-        double& operator[] (int i) { return e[i]; }
+        real operator[] (int i) const { return e[i]; }
+        real& operator[] (int i) { return e[i]; }
 
         vec3& operator+=(const vec3 &v)
         {
@@ -29,7 +29,7 @@ class vec3
             return *this;
         }
 
-        vec3& operator*=(double t)
+        vec3& operator*=(real t)
         {
             e[0] *= t;
             e[1] *= t;
@@ -37,17 +37,17 @@ class vec3
             return *this;
         }
 
-        vec3& operator/=(double t)
+        vec3& operator/=(real t)
         {
             return *this *= 1/t;
         }
 
-        double length() const
+        real length() const
         {
             return sqrt(length_squared());
         }
 
-        double length_squared() const
+        real length_squared() const
         {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
@@ -57,7 +57,7 @@ class vec3
             return vec3(random_double(), random_double(), random_double());
         }
 
-        static vec3 random(double min, double max)
+        static vec3 random(real min, real max)
         {
             return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
         }
@@ -92,22 +92,34 @@ inline vec3 operator*(const vec3 &u, const vec3 &v)
     return vec3(u.e[0]*v.e[0], u.e[1]*v.e[1], u.e[2]*v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3 &v)
+inline vec3 operator*(real t, const vec3 &v)
 {
     return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v, double t)
+inline vec3 operator*(const vec3 &v, real t)
 {
     return t*v;
 }
 
-inline vec3 operator/(vec3 v, double t)
+inline vec3 operator/(vec3 v, real t)
 {
     return (1/t)*v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v)
+//u*v + w per component
+inline vec3 mul_add(const vec3 &u, const vec3 &v, const vec3 &w)
+{
+    return vec3(u.e[0]*v.e[0] + w.e[0], u.e[1]*v.e[1] + w.e[1], u.e[2]*v.e[2] + w.e[2]);
+}
+
+//t*v + w
+inline vec3 mul_add(real t, const vec3 &v, const vec3 &w)
+{
+    return vec3(t*v.e[0] + w.e[0], t*v.e[1] + w.e[1], t*v.e[2] + w.e[2]);
+}
+
+inline real dot(const vec3 &u, const vec3 &v)
 {
     return u.e[0]*v.e[0] + u.e[1]*v.e[1] + u.e[2]*v.e[2];
 }
@@ -124,19 +136,44 @@ inline vec3 unit_vector(vec3 v)
     return v/v.length();
 }
 
-inline vec3 random_in_unit_sphere()
+//Direct mappings from the unit square, so well distributed sample pairs stay well distributed
+inline vec3 square_to_unit_vector(real u, real v)
+{
+    auto z = 1 - 2*u;
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2*pi*v;
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+inline vec3 square_to_unit_disk(real u, real v) //Concentric mapping
 {
-    while(true)
+    auto a = 2*u - 1;
+    auto b = 2*v - 1;
+    if(a == 0 && b == 0)
+        return vec3(0, 0, 0);
+    real r, phi;
+    if(fabs(a) > fabs(b))
     {
-        auto p = vec3::random(-1, 1);
-        if(p.length_squared() < 1)
-            return p;
+        r = a;
+        phi = (pi/4) * (b/a);
     }
+    else
+    {
+        r = b;
+        phi = (pi/2) - (pi/4) * (a/b);
+    }
+    return vec3(r*cos(phi), r*sin(phi), 0);
 }
 
 inline vec3 random_unit_vector()
 {
-    return unit_vector(random_in_unit_sphere());
+    auto u = random_double();
+    return square_to_unit_vector(u, random_double());
+}
+
+inline vec3 random_in_unit_sphere()
+{
+    return random_unit_vector() * std::cbrt(random_double());
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal)
@@ -150,25 +187,21 @@ inline vec3 random_on_hemisphere(const vec3& normal)
 
 inline vec3 reflect(const vec3& v, const vec3& n)
 {
-    return v - 2*dot(v,n)*n;
+    return mul_add(-2*dot(v,n), n, v);
 }
 
-inline vec3 refract(const vec3 uv, const vec3& n, double etai_over_etat)
+inline vec3 refract(const vec3 uv, const vec3& n, real etai_over_etat)
 {
     auto cos_theta = fmin(dot(-uv, n), 1.0);
-    vec3 r_out_prep = etai_over_etat * (uv + cos_theta*n);
+    vec3 r_out_prep = etai_over_etat * mul_add(cos_theta, n, uv);
     vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_prep.length_squared())) * n;
     return r_out_prep + r_out_parallel;
 }
 
 inline vec3 random_in_unit_disk()
 {
-    while(true)
-    {
-        auto p = vec3(random_double(-1, 1), random_double(-1,1), 0);
-        if(p.length_squared() < 1)
-            return p;
-    }
+    auto u = random_double();
+    return square_to_unit_disk(u, random_double());
 }
 
 #endif
\ No newline at end of file
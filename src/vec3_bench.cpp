@@ -0,0 +1,168 @@
+//Microbenchmark of the vec3 kernels the renderer leans on: the current vec3 against one with plain operators only.
+//Build with -DRAY_BENCHMARKS=ON, and with -DRAY_FLOAT=ON to time the single precision build.
+
+#include "rtweekend.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+//vec3 without mul_add: products and sums as separate operators
+namespace scalar
+{
+    class vec3
+    {
+        public:
+            real e[3];
+
+            vec3():e{0,0,0} {}
+            vec3(real e0, real e1, real e2):e{e0, e1, e2} {}
+
+            real length_squared() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+            real length() const { return sqrt(length_squared()); }
+    };
+
+    inline vec3 operator+(const vec3 &u, const vec3 &v) { return vec3(u.e[0]+v.e[0], u.e[1]+v.e[1], u.e[2]+v.e[2]); }
+    inline vec3 operator-(const vec3 &u, const vec3 &v) { return vec3(u.e[0]-v.e[0], u.e[1]-v.e[1], u.e[2]-v.e[2]); }
+    inline vec3 operator*(real t, const vec3 &v) { return vec3(t*v.e[0], t*v.e[1], t*v.e[2]); }
+    inline vec3 operator/(vec3 v, real t) { return (1/t)*v; }
+    inline real dot(const vec3 &u, const vec3 &v) { return u.e[0]*v.e[0] + u.e[1]*v.e[1] + u.e[2]*v.e[2]; }
+    inline vec3 unit_vector(vec3 v) { return v/v.length(); }
+    inline vec3 reflect(const vec3& v, const vec3& n) { return v - 2*dot(v,n)*n; }
+    inline vec3 mul_add(real t, const vec3 &v, const vec3 &w) { return t*v + w; }
+
+    inline double clamp(const interval& i, double x)
+    {
+        if(x < i.min) return i.min;
+        if(x > i.max) return i.max;
+        return x;
+    }
+}
+
+static const int count = 512; //Vectors per pass, small enough to stay in L1
+static const int passes = 4000;
+
+template<typename V>
+class bench_data
+{
+    public:
+        std::vector<V> origin, direction, normal, out;
+        std::vector<real> t;
+
+        bench_data()
+        {
+            thread_rng() = pcg32(1); //Both layouts see the same inputs
+            for(int k = 0; k < count; k++)
+            {
+                origin.emplace_back(random_double(-10, 10), random_double(0, 2), random_double(-10, 10));
+                direction.emplace_back(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+                normal.push_back(unit_vector(V(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1))));
+                t.push_back(random_double(0, 20));
+            }
+            out.resize(count);
+        }
+};
+
+//Best time per vector over a few repeats of passes over the data, in nanoseconds
+template<typename Kernel>
+double time_kernel(Kernel kernel)
+{
+    double best = infinity;
+    for(int repeat = 0; repeat < 20; repeat++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(int pass = 0; pass < passes; pass++)
+            kernel();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, ns / (double(passes) * count));
+    }
+    return best;
+}
+
+static volatile double sink; //Keeps the results alive
+
+//Point along each ray, as ray::at
+template<typename V>
+double bench_at(bench_data<V>& d)
+{
+    return time_kernel([&] {
+        for(int k = 0; k < count; k++)
+            d.out[k] = mul_add(d.t[k], d.direction[k], d.origin[k]);
+        sink = d.out[count - 1].e[0];
+    });
+}
+
+template<typename V>
+double bench_normalize(bench_data<V>& d)
+{
+    return time_kernel([&] {
+        for(int k = 0; k < count; k++)
+            d.out[k] = unit_vector(d.direction[k]);
+        sink = d.out[count - 1].e[0];
+    });
+}
+
+//Nearest root of each ray against one sphere, as sphere::intersect
+template<typename V>
+double bench_sphere(bench_data<V>& d)
+{
+    const V centre(0, 1, 0);
+    const real radius = 1.5;
+    return time_kernel([&] {
+        double sum = 0;
+        for(int k = 0; k < count; k++)
+        {
+            V oc = d.origin[k] - centre;
+            auto a = d.direction[k].length_squared();
+            auto half_b = dot(oc, d.direction[k]);
+            auto c = oc.length_squared() - radius*radius;
+            auto discriminant = half_b*half_b - a*c;
+            if(discriminant >= 0)
+                sum += (-half_b - sqrt(discriminant)) / a;
+        }
+        sink = sum;
+    });
+}
+
+//Mirror direction off the surface, as the metal scatter
+template<typename V>
+double bench_reflect(bench_data<V>& d)
+{
+    return time_kernel([&] {
+        for(int k = 0; k < count; k++)
+            d.out[k] = reflect(unit_vector(d.direction[k]), d.normal[k]);
+        sink = d.out[count - 1].e[0];
+    });
+}
+
+//Display encoding clamp, as the image writers
+template<typename V, typename Clamp>
+double bench_clamp(bench_data<V>& d, Clamp clamp)
+{
+    const interval intensity(0.000, 0.999);
+    return time_kernel([&] {
+        double sum = 0;
+        for(int k = 0; k < count; k++)
+            sum += clamp(intensity, d.direction[k].e[0]) + clamp(intensity, d.direction[k].e[1]);
+        sink = sum;
+    });
+}
+
+int main()
+{
+    bench_data<scalar::vec3> old_data;
+    bench_data<vec3> new_data;
+
+    std::printf("vec3 of %s, %zu bytes\n", sizeof(real) == 4 ? "float" : "double", sizeof(vec3));
+    std::printf("%-10s %10s %10s %8s\n", "kernel", "scalar ns", "vec3 ns", "speedup");
+
+    auto report = [](const char* name, double before, double after) {
+        std::printf("%-10s %10.2f %10.2f %7.2fx\n", name, before, after, before / after);
+    };
+    report("at", bench_at(old_data), bench_at(new_data));
+    report("normalize", bench_normalize(old_data), bench_normalize(new_data));
+    report("sphere", bench_sphere(old_data), bench_sphere(new_data));
+    report("reflect", bench_reflect(old_data), bench_reflect(new_data));
+    report("clamp", bench_clamp(old_data, scalar::clamp), bench_clamp(new_data, [](const interval& i, double x) { return i.clamp(x); }));
+    return 0;
+}
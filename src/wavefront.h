@@ -0,0 +1,271 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//Breadth-first alternative to camera::ray_color. All paths of a tile advance one bounce at a time:
+//the whole batch is intersected, the hits are sorted into one queue per material kind, and each
+//scatter routine runs over its own queue, so one code path stays hot instead of switching ray by ray.
+//Every path keeps its own sampler and random stream, so the image matches the depth-first integrator.
+//With a packet size set, camera rays and the first bounce are intersected in packets of neighbouring paths.
+//With a sort buffer set, secondary rays are reordered by direction octant and then by the Morton code of their
+//origin before each intersection, so consecutive traversals walk the same part of the tree.
+class wavefront_integrator
+{
+    public:
+        int packet_size = 0; //4, 8 or 16 rays per packet, 0 traces every ray on its own
+        int sort_buffer = 0; //Secondary rays reordered together, 0 keeps them in material queue order
+
+        //Renders tile t into image and returns the number of rays traced.
+        //Samples are batched so at most max_batch paths are in flight.
+        long long render(const camera& cam, const tile& t, const hittable& world, const material_table& materials,
+                         framebuffer& image)
+        {
+            const int width = t.x1 - t.x0;
+            const int pixels = width * (t.y1 - t.y0);
+            const int spp = cam.samples_per_pixel;
+            const int chunk = std::max(1, std::min(spp, max_batch / std::max(1, pixels)));
+            sums.assign(pixels, color(0, 0, 0));
+            long long segments = 0;
+
+            for(int first = 0; first < spp; first += chunk)
+            {
+                const int last = std::min(first + chunk, spp);
+                generate(cam, t, first, last);
+                for(int bounce = 0; bounce < cam.max_depth && !active.empty(); bounce++)
+                {
+                    segments += static_cast<long long>(active.size());
+                    if(bounce > 0 && sort_buffer > 1)
+                        reorder(world.bounding_box());
+                    intersect(cam, world, materials, bounce);
+                    next.clear();
+                    scatter_queue(cam, materials, bounce, queues[0], [](const material& m, const ray&, const hit_record& rec, color& a, ray& out, sampler& s)
+                                  { return m.scatter_lambertian(rec, a, out, s); });
+                    scatter_queue(cam, materials, bounce, queues[1], [](const material& m, const ray& in, const hit_record& rec, color& a, ray& out, sampler& s)
+                                  { return m.scatter_metal(in, rec, a, out, s); });
+                    scatter_queue(cam, materials, bounce, queues[2], [](const material& m, const ray& in, const hit_record& rec, color& a, ray& out, sampler& s)
+                                  { return m.scatter_dielectric(in, rec, a, out, s); });
+                    active.swap(next);
+                }
+
+                //Slots run pixel by pixel, sample by sample, so this sums in the depth-first order
+                for(int slot = 0; slot < static_cast<int>(results.size()); slot++)
+                    sums[slot / (last - first)] += results[slot];
+            }
+
+            for(int j = t.y0; j < t.y1; ++j)
+                for(int i = t.x0; i < t.x1; ++i)
+                    image.at(i, j) = sums[(j - t.y0) * width + (i - t.x0)] / float(spp);
+            return segments;
+        }
+
+    private:
+        static const int max_batch = 1 << 16;
+
+        class path
+        {
+            public:
+                ray r;
+                color throughput;
+                sampler s;
+                pcg32 rng; //The path's stream of thread_rng(), swapped in around its scatter calls
+                int slot; //Generation order, indexes results
+        };
+
+        class queued_hit
+        {
+            public:
+                int path;
+                hit_record rec;
+        };
+
+        std::vector<path> paths;
+        std::vector<int> active; //Paths still bouncing
+        std::vector<int> next;
+        std::vector<queued_hit> queues[3]; //Indexed by material::kind
+        std::vector<color> results; //Radiance of each finished path
+        std::vector<color> sums;
+        std::vector<uint64_t> keys;
+        std::vector<uint64_t> key_scratch;
+        std::vector<path> sorted;
+        ray_packet packet;
+
+        //Sorts each run of sort_buffer active paths by (octant, Morton code of the ray origin) and moves them
+        //into that order, so the following passes read path state front to back instead of at random.
+        //Paths carry their own random streams and are summed by slot, so the order never changes the image.
+        void reorder(const aabb& bounds)
+        {
+            //30 bit keys: the octant over a 512^3 grid of origins, sorted by three 10 bit radix passes
+            const int n = static_cast<int>(active.size());
+            double lo[3], scale[3];
+            for(int a = 0; a < 3; a++)
+            {
+                lo[a] = bounds.axis(a).min;
+                scale[a] = bounds.axis(a).size() > 0 ? 512 / bounds.axis(a).size() : 0;
+            }
+            keys.resize(n);
+            for(int k = 0; k < n; k++)
+            {
+                const ray& r = paths[active[k]].r;
+                uint32_t code = 0;
+                for(int a = 0; a < 3; a++)
+                {
+                    double q = std::min(std::max((r.origin()[a] - lo[a]) * scale[a], 0.0), 511.0);
+                    code |= expand_bits(static_cast<uint32_t>(q)) << (2 - a);
+                    code |= static_cast<uint32_t>(r.direction()[a] < 0) << (29 - a);
+                }
+                keys[k] = (static_cast<uint64_t>(code) << 32) | static_cast<uint32_t>(active[k]);
+            }
+            key_scratch.resize(n);
+            for(int first = 0; first < n; first += sort_buffer)
+                radix_sort(keys.data() + first, key_scratch.data() + first, std::min(sort_buffer, n - first));
+
+            sorted.clear();
+            for(int k = 0; k < n; k++)
+            {
+                sorted.push_back(paths[keys[k] & 0xffffffffu]);
+                active[k] = k;
+            }
+            paths.swap(sorted);
+        }
+
+        //LSD radix sort of n entries by their upper 30 bits; scratch holds n more
+        static void radix_sort(uint64_t* data, uint64_t* scratch, int n)
+        {
+            for(int shift = 32; shift < 62; shift += 10)
+            {
+                int count[1025] = {};
+                for(int k = 0; k < n; k++)
+                    count[((data[k] >> shift) & 1023) + 1]++;
+                for(int d = 0; d < 1024; d++)
+                    count[d + 1] += count[d];
+                for(int k = 0; k < n; k++)
+                    scratch[count[(data[k] >> shift) & 1023]++] = data[k];
+                std::swap(data, scratch);
+            }
+            //Three passes leave the result in scratch
+            std::copy(data, data + n, scratch);
+        }
+
+        void generate(const camera& cam, const tile& t, int first, int last)
+        {
+            paths.clear();
+            active.clear();
+            for(int j = t.y0; j < t.y1; ++j)
+                for(int i = t.x0; i < t.x1; ++i)
+                    for(int sample = first; sample < last; ++sample)
+                    {
+                        path p;
+                        p.s = sampler(cam.sampling, cam.samples_per_pixel);
+                        p.s.start_pixel_sample(i, j, sample, cam.frame);
+                        p.r = cam.get_ray(i, j, p.s);
+                        p.rng = thread_rng();
+                        p.throughput = color(1, 1, 1);
+                        p.slot = static_cast<int>(paths.size());
+                        active.push_back(p.slot);
+                        paths.push_back(p);
+                    }
+            results.assign(paths.size(), color(0, 0, 0));
+        }
+
+        //Closest hit of every active path; misses pick up the background and end.
+        //Packets are consecutive active paths, the samples of one pixel or of its neighbours. Only rays
+        //pointing into one octant go together, the rest of a packet is traced ray by ray.
+        void intersect(const camera& cam, const hittable& world, const material_table& materials, int bounce)
+        {
+            for(auto& q : queues)
+                q.clear();
+            const int n = static_cast<int>(active.size());
+            if(packet_size <= 0 || bounce > 1)
+            {
+                for(int index : active)
+                    intersect_single(cam, world, materials, index);
+                return;
+            }
+
+            closest_hit hits[ray_packet::max_size];
+            for(int first = 0; first < n; first += packet_size)
+            {
+                const int count = std::min(packet_size, n - first);
+                packet.reset(packet_size, ray_tmin);
+                for(int k = 0; k < count; k++)
+                    packet.set(k, paths[active[first + k]].r, infinity);
+                if(!packet.finish())
+                {
+                    for(int k = 0; k < count; k++)
+                        intersect_single(cam, world, materials, active[first + k]);
+                    continue;
+                }
+                world.intersect_packet(packet, packet.lanes, hits);
+                for(int k = 0; k < count; k++)
+                    enqueue(cam, materials, active[first + k], packet.tmax[k] < infinity ? &hits[k] : nullptr);
+            }
+        }
+
+        void intersect_single(const camera& cam, const hittable& world, const material_table& materials, int index)
+        {
+            closest_hit h;
+            bool hit = world.intersect(paths[index].r, interval(ray_tmin, infinity), h);
+            enqueue(cam, materials, index, hit ? &h : nullptr);
+        }
+
+        //Queues a hit for its material's scatter, or ends a path that missed
+        void enqueue(const camera& cam, const material_table& materials, int index, const closest_hit* h)
+        {
+            path& p = paths[index];
+            if(!h)
+            {
+                results[p.slot] = p.throughput * cam.background(p.r);
+                return;
+            }
+            queued_hit q;
+            q.path = index;
+            h->object->surface_interaction(p.r, *h, q.rec);
+            queues[static_cast<int>(materials[q.rec.mat].type())].push_back(q);
+        }
+
+        template<typename Scatter>
+        void scatter_queue(const camera& cam, const material_table& materials, int bounce, const std::vector<queued_hit>& queue,
+                           Scatter scatter)
+        {
+            pcg32& rng = thread_rng();
+            for(const queued_hit& q : queue)
+            {
+                path& p = paths[q.path];
+                rng = p.rng;
+                p.s.set_dimension(sampler::first_bounce_dimension + bounce);
+                color attenuation;
+                ray scattered;
+                if(scatter(materials[q.rec.mat], p.r, q.rec, attenuation, scattered, p.s))
+                {
+                    p.throughput = p.throughput * attenuation;
+                    p.r = scattered;
+                    if(cam.survives_roulette(p.throughput, bounce, p.s))
+                        next.push_back(q.path);
+                }
+                p.rng = rng;
+            }
+        }
+};
+
+//Wavefront render of one tile on the calling thread's integrator, whose buffers are reused across tiles
+inline long long render_wavefront(const camera& cam, const tile& t, const hittable& world, const material_table& materials,
+                                  framebuffer& image, int packet_size = 0, int sort_buffer = 0)
+{
+    thread_local wavefront_integrator integrator;
+    integrator.packet_size = packet_size;
+    integrator.sort_buffer = sort_buffer;
+    return integrator.render(cam, t, world, materials, image);
+}
+
+#endif